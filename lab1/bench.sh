@@ -0,0 +1,41 @@
+#!/usr/bin/env bash
+# Сборка и запуск нагрузочного стенда: bash bench.sh [аргументы lab1d-bench]
+set -euo pipefail
+
+ROOT="$(cd "$(dirname "$0")" && pwd)"
+BUILD="$ROOT/.build-bench"
+BIN="$ROOT/bin"
+
+mkdir -p "$BUILD" "$BIN"
+
+SRCS=(
+  bench/lab1d_bench.cpp
+  src/config.cpp
+  src/file_worker.cpp
+  src/utils.cpp
+  src/rule_pool.cpp
+  src/transfer.cpp
+  src/dest_index.cpp
+  src/dir_scanner.cpp
+  src/uring.cpp
+  src/matcher.cpp
+  src/metrics.cpp
+  src/work_stealing.cpp
+  src/content_index.cpp
+  src/xxhash64.cpp
+  src/log.cpp
+  src/state_file.cpp
+  src/commit.cpp
+  src/schedule.cpp
+  src/dir_fd.cpp
+  src/throttle.cpp
+)
+
+for s in "${SRCS[@]}"; do
+  o="$BUILD/$(basename "${s%.cpp}.o")"
+  g++ -std=c++17 -O2 -Wall -Werror -pthread -Isrc -c "$ROOT/$s" -o "$o"
+done
+g++ -pthread "$BUILD"/*.o -o "$BIN/lab1d-bench"
+rm -rf "$BUILD"
+
+exec "$BIN/lab1d-bench" "$@"
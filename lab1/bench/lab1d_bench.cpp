@@ -0,0 +1,383 @@
+// Нагрузочный стенд lab1d: генерирует дерево файлов, пишет конфиг, грузит его
+// через load_config и прогоняет process_source через RulePool, как демон за один тик.
+// Результат — по строке JSON на сценарий.
+
+#include "config.h"
+#include "file_worker.h"
+#include "metrics.h"
+#include "rule_pool.h"
+
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <syslog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct Options {
+    size_t files = 10000;
+    size_t size_min = 4096;
+    size_t size_max = 4096;
+    bool size_log = false; // log-uniform: много мелких файлов и немного крупных, как в живых каталогах
+    std::vector<std::pair<std::string, unsigned>> ext_mix{{"txt", 50}, {"jpg", 30}, {"bin", 20}};
+    std::string filter = "jpg";
+    double collide = 0.0;
+    size_t sources = 1;
+    int workers = 1;
+    std::string backend = "sync";
+    std::string root = "/dev/shm/lab1d-bench";
+    std::string xdev_root = "/var/tmp/lab1d-bench";
+    std::string scenario = "both";
+    bool count_syscalls = false;
+    unsigned seed = 1;
+};
+
+struct Tree {
+    fs::path conf;
+    size_t to_move = 0;
+    uint64_t bytes = 0;
+};
+
+struct RunResult {
+    double seconds = 0;
+    uint64_t moved = 0, copied = 0, bytes = 0, errors = 0;
+    uint64_t p50_us = 0, p99_us = 0;
+};
+
+static void usage(const char *argv0) {
+    std::fprintf(stderr,
+        "Usage: %s [--files N] [--size MIN[:MAX]] [--size-dist uniform|log] [--ext-mix txt:50,jpg:30,...] [--filter SPEC]\n"
+        "          [--collide RATE] [--sources K] [--workers W] [--backend sync|uring]\n"
+        "          [--root DIR] [--xdev-root DIR] [--scenario same|exdev|both] [--count-syscalls] [--seed S]\n",
+        argv0);
+}
+
+static bool parse_args(int argc, char **argv, Options &o) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto val = [&]() -> std::string { return i + 1 < argc ? argv[++i] : ""; };
+        if (a == "--files") {
+            o.files = std::strtoull(val().c_str(), nullptr, 10);
+        }
+        else if (a == "--size") {
+            std::string v = val();
+            auto colon = v.find(':');
+            o.size_min = std::strtoull(v.c_str(), nullptr, 10);
+            o.size_max = colon == std::string::npos ? o.size_min : std::strtoull(v.c_str() + colon + 1, nullptr, 10);
+            if (o.size_max < o.size_min)
+                return false;
+        }
+        else if (a == "--size-dist") {
+            std::string v = val();
+            if (v != "uniform" && v != "log")
+                return false;
+            o.size_log = v == "log";
+        }
+        else if (a == "--ext-mix") {
+            o.ext_mix.clear();
+            std::string v = val();
+            for (size_t s = 0; s < v.size(); ) {
+                size_t e = v.find(',', s);
+                std::string item = v.substr(s, e == std::string::npos ? std::string::npos : e - s);
+                s = e == std::string::npos ? v.size() : e + 1;
+                auto colon = item.find(':');
+                unsigned w = colon == std::string::npos ? 1 : std::atoi(item.c_str() + colon + 1);
+                o.ext_mix.emplace_back(item.substr(0, colon), w);
+            }
+            if (o.ext_mix.empty())
+                return false;
+        }
+        else if (a == "--filter") {
+            o.filter = val();
+        }
+        else if (a == "--collide") {
+            o.collide = std::atof(val().c_str());
+        }
+        else if (a == "--sources") {
+            o.sources = std::max<size_t>(1, std::strtoull(val().c_str(), nullptr, 10));
+        }
+        else if (a == "--workers") {
+            o.workers = std::max(1, std::atoi(val().c_str()));
+        }
+        else if (a == "--backend") {
+            o.backend = val();
+        }
+        else if (a == "--root") {
+            o.root = val();
+        }
+        else if (a == "--xdev-root") {
+            o.xdev_root = val();
+        }
+        else if (a == "--scenario") {
+            o.scenario = val();
+        }
+        else if (a == "--count-syscalls") {
+            o.count_syscalls = true;
+        }
+        else if (a == "--seed") {
+            o.seed = static_cast<unsigned>(std::strtoul(val().c_str(), nullptr, 10));
+        }
+        else {
+            return false;
+        }
+    }
+    return o.scenario == "same" || o.scenario == "exdev" || o.scenario == "both";
+}
+
+static bool write_file(const fs::path &p, const std::vector<char> &data, size_t size) {
+    int fd = open(p.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    size_t done = 0;
+    while (done < size) {
+        size_t chunk = std::min(size - done, data.size());
+        ssize_t n = write(fd, data.data(), chunk);
+        if (n <= 0)
+            break;
+        done += static_cast<size_t>(n);
+    }
+    close(fd);
+    return done == size;
+}
+
+static bool keeps(const std::string &filter, const std::string &ext) {
+    Matcher m;
+    std::string err;
+    if (!m.compile(filter, err))
+        return false;
+    std::string name = "x." + ext;
+    return !m.matches(name.c_str(), name.size());
+}
+
+// Свежее дерево под каждый прогон: src/<k>, dst/<k>, часть имён уже занята в dst.
+static bool make_tree(const Options &o, const fs::path &src_root, const fs::path &dst_root, Tree &t) {
+    std::error_code ec;
+    fs::remove_all(src_root, ec);
+    fs::remove_all(dst_root, ec);
+
+    std::mt19937_64 rng(o.seed);
+    std::vector<char> data(1 << 20);
+    for (auto &c : data)
+        c = static_cast<char>(rng());
+
+    unsigned total_w = 0;
+    for (const auto &[_, w] : o.ext_mix)
+        total_w += w;
+    std::vector<bool> kept(o.ext_mix.size());
+    for (size_t i = 0; i < o.ext_mix.size(); ++i)
+        kept[i] = keeps(o.filter, o.ext_mix[i].first);
+
+    t = Tree{};
+    t.conf = src_root / "bench.conf";
+    fs::create_directories(src_root, ec);
+    std::ofstream conf(t.conf);
+    conf << "interval 1\n";
+    for (size_t k = 0; k < o.sources; ++k) {
+        fs::path s = src_root / std::to_string(k), d = dst_root / std::to_string(k);
+        fs::create_directories(s, ec);
+        fs::create_directories(d, ec);
+        if (ec) {
+            std::fprintf(stderr, "cannot create %s: %s\n", d.c_str(), ec.message().c_str());
+            return false;
+        }
+        conf << s.string() << " " << d.string() << " " << o.filter << "\n";
+    }
+    conf.close();
+
+    std::uniform_int_distribution<size_t> size_dist(o.size_min, o.size_max);
+    std::uniform_real_distribution<double> log_dist(std::log(double(std::max<size_t>(1, o.size_min))),
+                                                    std::log(double(std::max<size_t>(1, o.size_max))));
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    char name[64];
+    for (size_t i = 0; i < o.files; ++i) {
+        unsigned pick = static_cast<unsigned>(rng() % total_w), e = 0;
+        while (pick >= o.ext_mix[e].second) {
+            pick -= o.ext_mix[e].second;
+            ++e;
+        }
+        size_t k = i % o.sources;
+        std::snprintf(name, sizeof(name), "f%07zu.%s", i, o.ext_mix[e].first.c_str());
+        size_t sz = o.size_log ? std::clamp(size_t(std::exp(log_dist(rng))), o.size_min, o.size_max) : size_dist(rng);
+        if (!write_file(src_root / std::to_string(k) / name, data, sz))
+            return false;
+        if (kept[e])
+            continue;
+        ++t.to_move;
+        t.bytes += sz;
+        if (o.collide > 0 && coin(rng) < o.collide)
+            write_file(dst_root / std::to_string(k) / name, data, 0);
+    }
+    return true;
+}
+
+static WorkerOptions worker_options(const Options &o) {
+    WorkerOptions w;
+    w.backend = o.backend == "uring" ? MoveBackend::Uring : MoveBackend::Sync;
+    return w;
+}
+
+static RunResult run_once(const Options &o, const Tree &t) {
+    std::vector<Rule> rules = load_config(t.conf.string());
+    metrics_begin_update();
+    for (size_t i = 0; i < rules.size(); ++i) {
+        rules[i].slot = static_cast<int>(i);
+        metrics_assign(rules[i].slot, rules[i].from.string(), rules[i].to.string(), rules[i].spec);
+    }
+    metrics_end_update(rules.size());
+    std::vector<SourceGroup> sources = group_by_source(rules);
+
+    RulePool pool;
+    pool.start(static_cast<size_t>(o.workers), static_cast<size_t>(o.workers));
+    auto t0 = std::chrono::steady_clock::now();
+    pool.run(sources, worker_options(o));
+    RunResult r;
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    pool.stop();
+
+    // Сводная гистограмма по всем правилам.
+    Histogram all{};
+    for (const Rule &rule : rules) {
+        RuleMetrics *m = metrics_rule(rule.slot);
+        if (!m)
+            continue;
+        r.moved += m->moved.load();
+        r.copied += m->copied.load();
+        r.bytes += m->bytes.load();
+        r.errors += m->errors.load();
+        for (size_t b = 0; b < kHistBuckets; ++b)
+            all.buckets[b] += m->move_us.buckets[b].load();
+    }
+    r.p50_us = hist_quantile(all, 0.50);
+    r.p99_us = hist_quantile(all, 0.99);
+    return r;
+}
+
+// Число системных вызовов за один прогон: дочерний процесс под ptrace, считаются
+// входы в syscall всех потоков между двумя метками SIGUSR1 вокруг прогона.
+static long count_syscalls(const Options &o, const Tree &t) {
+    pid_t child = fork();
+    if (child < 0)
+        return -1;
+    if (child == 0) {
+        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        raise(SIGSTOP);
+        raise(SIGUSR1);
+        run_once(o, t);
+        raise(SIGUSR1);
+        _exit(0);
+    }
+
+    int st = 0;
+    waitpid(child, &st, 0);
+    ptrace(PTRACE_SETOPTIONS, child, nullptr,
+           reinterpret_cast<void *>(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL));
+    ptrace(PTRACE_SYSCALL, child, nullptr, nullptr);
+
+    long count = 0;
+    int marks = 0;
+    std::unordered_map<pid_t, bool> in_syscall;
+    for (;;) {
+        pid_t tid = waitpid(-1, &st, __WALL);
+        if (tid < 0)
+            break;
+        if (WIFEXITED(st) || WIFSIGNALED(st)) {
+            if (tid == child)
+                break;
+            continue;
+        }
+        int sig = 0;
+        if (WIFSTOPPED(st)) {
+            int s = WSTOPSIG(st);
+            if (s == (SIGTRAP | 0x80)) {
+                bool &entering = in_syscall[tid];
+                entering = !entering;
+                if (entering && marks == 1)
+                    ++count;
+            } else if (s == SIGUSR1) {
+                ++marks;
+            } else if (s != SIGTRAP && s != SIGSTOP) {
+                sig = s;
+            }
+        }
+        ptrace(PTRACE_SYSCALL, tid, nullptr, reinterpret_cast<void *>(static_cast<long>(sig)));
+    }
+    return count;
+}
+
+static void scenario(const Options &o, const std::string &name, const fs::path &src_root, const fs::path &dst_root) {
+    struct stat a{}, b{};
+    stat(src_root.parent_path().c_str(), &a);
+    stat(dst_root.parent_path().c_str(), &b);
+    if (name == "exdev" && a.st_dev == b.st_dev)
+        std::fprintf(stderr, "warning: %s and %s are on the same device, no EXDEV\n", src_root.c_str(), dst_root.c_str());
+
+    Tree t;
+    if (!make_tree(o, src_root, dst_root, t)) {
+        std::fprintf(stderr, "cannot generate tree under %s\n", src_root.c_str());
+        return;
+    }
+    RunResult r = run_once(o, t);
+
+    long sys = -1;
+    if (o.count_syscalls && make_tree(o, src_root, dst_root, t))
+        sys = count_syscalls(o, t);
+
+    double fps = r.seconds > 0 ? r.moved / r.seconds : 0;
+    double bps = r.seconds > 0 ? t.bytes / r.seconds : 0;
+    std::printf("{\"scenario\":\"%s\",\"backend\":\"%s\",\"files\":%zu,\"to_move\":%zu,\"moved\":%llu,\"copied\":%llu,"
+                "\"errors\":%llu,\"bytes\":%llu,\"seconds\":%.6f,\"files_per_sec\":%.1f,\"bytes_per_sec\":%.1f,"
+                "\"p50_us\":%llu,\"p99_us\":%llu,\"syscalls_per_file\":",
+                name.c_str(), o.backend.c_str(), o.files, t.to_move, (unsigned long long)r.moved,
+                (unsigned long long)r.copied, (unsigned long long)r.errors, (unsigned long long)t.bytes,
+                r.seconds, fps, bps, (unsigned long long)r.p50_us, (unsigned long long)r.p99_us);
+    if (sys >= 0 && t.to_move)
+        std::printf("%.2f}\n", static_cast<double>(sys) / t.to_move);
+    else
+        std::printf("null}\n");
+    std::fflush(stdout);
+
+    std::error_code ec;
+    fs::remove_all(src_root, ec);
+    fs::remove_all(dst_root, ec);
+}
+
+int main(int argc, char **argv) {
+    Options o;
+    if (!parse_args(argc, argv, o)) {
+        usage(argv[0]);
+        return 2;
+    }
+    openlog("lab1d-bench", LOG_PID | LOG_PERROR, LOG_USER);
+    setlogmask(LOG_UPTO(LOG_WARNING));
+
+    std::string mpath = "/dev/shm/lab1d-bench." + std::to_string(getpid()) + ".metrics";
+    if (!metrics_open(mpath)) {
+        std::fprintf(stderr, "cannot create %s\n", mpath.c_str());
+        return 1;
+    }
+
+    fs::path root = o.root, xroot = o.xdev_root;
+    if (o.scenario == "same" || o.scenario == "both")
+        scenario(o, "same", root / "src", root / "dst");
+    if (o.scenario == "exdev" || o.scenario == "both")
+        scenario(o, "exdev", root / "src", xroot / "dst");
+
+    metrics_close();
+    closelog();
+    return 0;
+}
@@ -14,14 +14,58 @@ SRCS=(
   src/file_worker.cpp
   src/daemon_utils.cpp
   src/utils.cpp
+  src/watcher.cpp
+  src/rule_pool.cpp
+  src/transfer.cpp
+  src/dest_index.cpp
+  src/dir_scanner.cpp
+  src/uring.cpp
+  src/matcher.cpp
+  src/metrics.cpp
+  src/work_stealing.cpp
+  src/content_index.cpp
+  src/xxhash64.cpp
+  src/log.cpp
+  src/state_file.cpp
+  src/commit.cpp
+  src/schedule.cpp
+  src/dir_fd.cpp
+  src/throttle.cpp
+  src/shard.cpp
+  src/handover.cpp
+  src/control.cpp
+  src/reactor.cpp
 )
 
-for s in "${SRCS[@]}"; do
-  o="$BUILD/$(basename "${s%.cpp}.o")"
-  g++ -std=c++17 -O2 -Wall -Werror -Isrc -c "$ROOT/$s" -o "$o"
-done
+STAT_SRCS=(
+  src/lab1d_stat.cpp
+  src/metrics.cpp
+  src/log.cpp
+)
+
+CTL_SRCS=(
+  src/lab1d_ctl.cpp
+  src/control.cpp
+  src/log.cpp
+)
+
+compile() {
+  local out="$1"; shift
+  mkdir -p "$out"
+  for s in "$@"; do
+    o="$out/$(basename "${s%.cpp}.o")"
+    g++ -std=c++17 -O2 -Wall -Werror -pthread -Isrc -c "$ROOT/$s" -o "$o"
+  done
+}
+
+compile "$BUILD/lab1d" "${SRCS[@]}"
+g++ -pthread "$BUILD"/lab1d/*.o -o "$BIN/lab1d"
+
+compile "$BUILD/lab1d-stat" "${STAT_SRCS[@]}"
+g++ "$BUILD"/lab1d-stat/*.o -o "$BIN/lab1d-stat"
 
-g++ "$BUILD"/*.o -o "$BIN/lab1d"
+compile "$BUILD/lab1d-ctl" "${CTL_SRCS[@]}"
+g++ -pthread "$BUILD"/lab1d-ctl/*.o -o "$BIN/lab1d-ctl"
 
 rm -rf "$BUILD"
-echo "Built: $BIN/lab1d"
+echo "Built: $BIN/lab1d $BIN/lab1d-stat $BIN/lab1d-ctl"
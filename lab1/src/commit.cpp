@@ -0,0 +1,166 @@
+#include "commit.h"
+#include "log.h"
+#include "state_file.h"
+#include "utils.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+static CommitOptions g_opts;
+
+// Пачка фиксируется досрочно, когда свободных записей журнала остаётся меньше:
+// ожидающие копии держат свои записи, а журнал общий для всех потоков и процессов.
+static constexpr size_t kJournalReserve = 8;
+
+using Clock = std::chrono::steady_clock;
+
+void commit_set_options(const CommitOptions &o) {
+    g_opts = o;
+}
+
+bool commit_enabled() {
+    return g_opts.mode != Durability::Off;
+}
+
+bool parse_durability(const std::string &s, Durability &out) {
+    std::string v = to_lower(s);
+    if (v == "off")
+        out = Durability::Off;
+    else if (v == "syncfs")
+        out = Durability::Syncfs;
+    else if (v == "fdatasync")
+        out = Durability::Fdatasync;
+    else
+        return false;
+    return true;
+}
+
+const char *durability_name(Durability d) {
+    switch (d) {
+    case Durability::Off: return "off";
+    case Durability::Syncfs: return "syncfs";
+    case Durability::Fdatasync: return "fdatasync";
+    }
+    return "?";
+}
+
+void CommitBatch::add(int from_fd, const char *name, const fs::path &from_dir, std::vector<Copy> copies) {
+    if (pending_.empty())
+        first_ = Clock::now();
+    for (const Copy &c : copies)
+        state_copy_committing(c.journal, c.dst);
+    pending_.push_back(Entry{from_fd, name ? name : "", from_dir, std::move(copies)});
+    const auto age = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - first_).count();
+    if (pending_.size() >= g_opts.max_files || uint64_t(age) >= g_opts.max_ms) {
+        flush();
+    } else if (state_copy_free() < kJournalReserve) {
+        log_msg(LOG_NOTICE, "durability: copy journal nearly full, committing %zu file(s) early", pending_.size());
+        flush();
+    }
+}
+
+void CommitBatch::due() {
+    if (pending_.empty())
+        return;
+    const auto age = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - first_).count();
+    if (uint64_t(age) >= g_opts.max_ms)
+        flush();
+}
+
+// Каталоги назначения — O_PATH, а syncfs и fsync такие дескрипторы не берут:
+// каждый каталог открывается заново, один раз на пачку.
+static int open_dir(int fd) {
+    return openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+bool CommitBatch::sync() {
+    std::vector<const Copy *> dirs; // по разу на каталог назначения
+    for (const Entry &e : pending_)
+        for (const Copy &c : e.copies)
+            if (std::none_of(dirs.begin(), dirs.end(), [&](const Copy *d) { return d->to_fd == c.to_fd; }))
+                dirs.push_back(&c);
+
+    if (g_opts.mode == Durability::Fdatasync) {
+        for (const Entry &e : pending_)
+            for (const Copy &c : e.copies) {
+                int fd = openat(c.to_fd, c.dst.filename().c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0 || fdatasync(fd) != 0) {
+                    log_msg(LOG_ERR, "durability: fdatasync %s: %m", c.dst.c_str());
+                    if (fd >= 0)
+                        close(fd);
+                    return false;
+                }
+                close(fd);
+            }
+    }
+
+    std::vector<dev_t> synced; // syncfs — по разу на файловую систему
+    for (const Copy *d : dirs) {
+        int fd = open_dir(d->to_fd);
+        struct stat sb{};
+        bool ok = fd >= 0 && fstat(fd, &sb) == 0;
+        if (ok && g_opts.mode == Durability::Syncfs) {
+            if (std::find(synced.begin(), synced.end(), sb.st_dev) == synced.end()) {
+                ok = syncfs(fd) == 0;
+                synced.push_back(sb.st_dev);
+            }
+        } else if (ok) {
+            ok = fsync(fd) == 0;
+        }
+        if (!ok)
+            log_msg(LOG_ERR, "durability: %s %s: %m", durability_name(g_opts.mode), d->dst.parent_path().c_str());
+        if (fd >= 0)
+            close(fd);
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+size_t CommitBatch::flush() {
+    if (pending_.empty())
+        return 0;
+    auto t0 = Clock::now();
+    const bool ok = sync();
+    for (Entry &e : pending_) {
+        if (!ok && e.name.empty()) {
+            // источник уже переименован в основное назначение (fanout=) и второй
+            // доставки не будет: удалённые копии просто пропали бы — оставляем их
+            for (const Copy &c : e.copies) {
+                log_msg(LOG_WARNING, "durability: keeping unsynced copy %s", c.dst.c_str());
+                state_copy_end(c.journal);
+            }
+            ++errors_;
+            continue;
+        }
+        if (!ok) {
+            // копии не подтверждены: убираем их, источник остаётся и уедет снова
+            for (const Copy &c : e.copies) {
+                unlinkat(c.to_fd, c.dst.filename().c_str(), 0);
+                state_copy_end(c.journal);
+            }
+            ++errors_;
+            continue;
+        }
+        for (const Copy &c : e.copies)
+            state_copy_placed(c.journal, c.dst);
+        if (!e.name.empty() && unlinkat(e.from_fd, e.name.c_str(), 0) != 0 && errno != ENOENT) {
+            log_msg(LOG_ERR, "transfer: remove source %s/%s: %m", e.from_dir.c_str(), e.name.c_str());
+            ++errors_;
+        }
+        for (const Copy &c : e.copies)
+            state_copy_end(c.journal);
+    }
+    const size_t n = pending_.size();
+    pending_.clear();
+    const auto us = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+    if (metrics_)
+        hist_add(metrics_->commit_us, us);
+    log_msg(LOG_DEBUG, "durability: committed %zu file(s) in %lluus", n, (unsigned long long)us);
+    return n;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "metrics.h"
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Когда копия на другом устройстве считается сохранённой.
+enum class Durability {
+    Off,       // как раньше: источник удаляется сразу, сброс на диск — на усмотрение ядра
+    Syncfs,    // один syncfs на файловую систему назначения за пачку
+    Fdatasync, // fdatasync каждой копии и fsync каждого каталога назначения за пачку
+};
+
+struct CommitOptions {
+    Durability mode = Durability::Off;
+    size_t max_files = 64;  // пачка фиксируется, набрав столько файлов
+    unsigned max_ms = 200;  // или когда первой копии в ней столько миллисекунд
+};
+
+// Зовётся при загрузке конфига, пока переносы не идут.
+void commit_set_options(const CommitOptions &o);
+bool commit_enabled();
+bool parse_durability(const std::string &s, Durability &out);
+const char *durability_name(Durability d);
+
+// Групповая фиксация межустройственных переносов: копии уже под своими именами
+// в назначении, но источники удаляются только после того, как вся пачка сброшена
+// на диск, — один syncfs/fsync на назначение вместо одного на файл. До фиксации
+// запись журнала в Committing (с путём копии), так что после сбоя источник цел,
+// неподтверждённая копия удаляется и перенос повторится; Placed ставится уже
+// после сброса. Ожидающие копии держат записи журнала — при их нехватке пачка
+// фиксируется раньше.
+// Дескрипторы каталогов, переданные в add(), должны жить до flush().
+class CommitBatch {
+public:
+    explicit CommitBatch(RuleMetrics *metrics) : metrics_(metrics) {}
+    ~CommitBatch() { flush(); }
+    CommitBatch(const CommitBatch &) = delete;
+    CommitBatch &operator=(const CommitBatch &) = delete;
+
+    // Копия, размещённая как dst в каталоге to_fd; journal — её запись в журнале
+    // (transfer_file с unlink_src=false).
+    struct Copy {
+        int to_fd;
+        fs::path dst;
+        int journal;
+    };
+
+    // Копии источника name из from_fd; name == nullptr — источник уже ушёл сам
+    // (rename в основное назначение fanout=), фиксируются только копии; если
+    // сброс не удался, такие копии остаются на месте, а не удаляются.
+    // Заполненная пачка фиксируется тут же.
+    void add(int from_fd, const char *name, const fs::path &from_dir, std::vector<Copy> copies);
+    void add(int from_fd, const char *name, const fs::path &from_dir, int to_fd, fs::path dst, int journal) {
+        std::vector<Copy> one;
+        one.push_back(Copy{to_fd, std::move(dst), journal});
+        add(from_fd, name, from_dir, std::move(one));
+    }
+    // Сбрасывает пачку на диск и удаляет источники; возвращает число файлов.
+    size_t flush();
+    // Фиксирует пачку, если её первой копии уже commit_ms: зовётся перед каждым
+    // файлом прохода, чтобы медленные или пропущенные файлы не держали пачку
+    // (и её записи журнала) дольше срока до следующего add() или конца прохода.
+    void due();
+    // Ошибки с начала жизни пачки: источники, которые не удалось сбросить или удалить.
+    size_t errors() const { return errors_; }
+
+private:
+    struct Entry {
+        int from_fd;
+        std::string name; // пусто — источник удалять не нужно
+        fs::path from_dir;
+        std::vector<Copy> copies;
+    };
+    bool sync();
+
+    RuleMetrics *metrics_;
+    std::vector<Entry> pending_;
+    std::chrono::steady_clock::time_point first_{};
+    size_t errors_ = 0;
+};
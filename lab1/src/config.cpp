@@ -1,20 +1,245 @@
 #include "config.h"
+#include "log.h"
 #include "utils.h"
 
-#include <syslog.h>
+#include <sys/stat.h>
 
+#include <algorithm>
+#include <cstdio>
 #include <fstream>
+#include <map>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
-std::vector<Rule> load_config(const std::string &conf_path) {
-    std::vector<Rule> out;
+// Необязательные параметры после фильтра: key=value.
+static bool parse_rule_option(const std::string &tok, Rule &r, std::string &err) {
+    auto eq = tok.find('=');
+    if (eq == std::string::npos || eq == 0) {
+        err = "expected key=value, got '" + tok + "'";
+        return false;
+    }
+    std::string key = tok.substr(0, eq), val = tok.substr(eq + 1);
+    uint64_t v = 0;
+    if (key == "max_files" || key == "max_bytes" || key == "max_ms") {
+        if (!parse_size(val, v)) {
+            err = "bad value for " + key;
+            return false;
+        }
+        if (key == "max_files")
+            r.budget.max_files = v;
+        else if (key == "max_bytes")
+            r.budget.max_bytes = v;
+        else
+            r.budget.max_ms = static_cast<unsigned>(v);
+        return true;
+    }
+    if (key == "rate_bytes" || key == "rate_ops") {
+        if (!parse_size(val, v)) {
+            err = "bad value for " + key;
+            return false;
+        }
+        (key == "rate_bytes" ? r.rate.bytes : r.rate.ops) = v;
+        return true;
+    }
+    if (key == "ioprio") {
+        if (!parse_ioprio(to_lower(val), r.ioprio)) {
+            err = "ioprio expects idle, be, be:0..7 or off";
+            return false;
+        }
+        return true;
+    }
+    if (key == "recursive") {
+        std::string mode = to_lower(val);
+        if (mode == "mirror")
+            r.tree = TreeMode::Mirror;
+        else if (mode == "flatten")
+            r.tree = TreeMode::Flatten;
+        else if (mode == "off" || mode == "no")
+            r.tree = TreeMode::Flat;
+        else {
+            err = "recursive expects mirror or flatten";
+            return false;
+        }
+        return true;
+    }
+    if (key == "dedupe") {
+        std::string mode = to_lower(val);
+        if (mode == "drop")
+            r.dedupe = Dedupe::Drop;
+        else if (mode == "link")
+            r.dedupe = Dedupe::Link;
+        else if (mode == "off" || mode == "no")
+            r.dedupe = Dedupe::Off;
+        else {
+            err = "dedupe expects drop or link";
+            return false;
+        }
+        return true;
+    }
+    if (key == "interval" || key == "jitter") {
+        int sec = 0;
+        if (!parse_duration(val, sec) || (key == "interval" && sec == 0)) {
+            err = key + " expects seconds with optional s/m/h/d suffix";
+            return false;
+        }
+        (key == "interval" ? r.interval : r.jitter) = sec;
+        return true;
+    }
+    if (key == "window")
+        return parse_window(val, r.window, err);
+    if (key == "fanout") {
+        r.fanout.clear();
+        for (size_t start = 0; start <= val.size(); ) {
+            size_t comma = val.find(',', start);
+            std::string dir = val.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+            start = comma == std::string::npos ? val.size() + 1 : comma + 1;
+            if (dir.empty()) {
+                err = "fanout expects a comma-separated list of directories";
+                return false;
+            }
+            r.fanout.emplace_back(dir);
+        }
+        return true;
+    }
+    if (key == "depth") {
+        if (!parse_size(val, v) || v == 0) {
+            err = "depth expects a positive integer";
+            return false;
+        }
+        r.max_depth = static_cast<unsigned>(v);
+        return true;
+    }
+    err = "unknown option '" + key + "'";
+    return false;
+}
+
+static bool parse_flag(const std::string &v, bool &out) {
+    std::string w = to_lower(v);
+    if (w == "on" || w == "yes" || w == "1") {
+        out = true;
+        return true;
+    }
+    if (w == "off" || w == "no" || w == "0") {
+        out = false;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_positive(const std::string &v, int &out) {
+    try {
+        size_t pos = 0;
+        int n = std::stoi(v, &pos);
+        if (pos != v.size() || n <= 0)
+            return false;
+        out = n;
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+// Глобальный параметр "key value"; false — строка не параметр, а правило.
+static bool parse_option(const std::string &key, const std::string &val, size_t lineno, Config &c, Budget &budget) {
+    auto bad = [&](const char *what) {
+        log_msg(LOG_WARNING, "bad '%s' at line %zu: expected %s", key.c_str(), lineno, what);
+    };
+    uint64_t n = 0;
+    if (key == "interval") {
+        if (!parse_positive(val, c.interval))
+            bad("positive integer");
+    } else if (key == "min_interval") {
+        if (!parse_positive(val, c.min_interval))
+            bad("positive integer");
+    } else if (key == "workers") {
+        if (!parse_positive(val, c.workers))
+            bad("positive integer");
+    } else if (key == "device_workers") {
+        if (!parse_positive(val, c.device_workers))
+            bad("positive integer");
+    } else if (key == "tree_workers") {
+        if (!parse_positive(val, c.tree_workers))
+            bad("positive integer");
+    } else if (key == "processes") {
+        if (!parse_positive(val, c.processes))
+            bad("positive integer");
+    } else if (key == "copy_threads") {
+        if (!parse_positive(val, c.copy_threads))
+            bad("positive integer");
+    } else if (key == "chunked_min") {
+        if (!parse_size(val, n))
+            bad("size");
+        else
+            c.chunked_min = n;
+    } else if (key == "direct_io") {
+        if (!parse_flag(val, c.direct_io))
+            bad("on/off");
+    } else if (key == "durability") {
+        if (!parse_durability(val, c.commit.mode))
+            bad("off, syncfs or fdatasync");
+    } else if (key == "commit_files" || key == "commit_ms") {
+        int v = 0;
+        if (!parse_positive(val, v))
+            bad("positive integer");
+        else if (key == "commit_files")
+            c.commit.max_files = size_t(v);
+        else
+            c.commit.max_ms = unsigned(v);
+    } else if (key == "rate_bytes" || key == "rate_ops") {
+        if (!parse_size(val, n))
+            bad("size");
+        else
+            (key == "rate_bytes" ? c.rate.bytes : c.rate.ops) = n;
+    } else if (key == "ioprio") {
+        if (!parse_ioprio(to_lower(val), c.ioprio))
+            bad("idle, be, be:0..7 or off");
+    } else if (key == "watch") {
+        if (!parse_flag(val, c.watch))
+            bad("on/off");
+    } else if (key == "auto_reload") {
+        if (!parse_flag(val, c.auto_reload))
+            bad("on/off");
+    } else if (key == "jitter") {
+        if (!parse_duration(val, c.jitter))
+            bad("seconds");
+    } else if (key == "schedule") {
+        std::string v = to_lower(val);
+        if (v == "fixed-rate" || v == "fixed-delay")
+            c.fixed_rate = v == "fixed-rate";
+        else
+            bad("fixed-delay or fixed-rate");
+    } else if (key == "backend") {
+        c.backend = to_lower(val);
+    } else if (key == "metrics") {
+        c.metrics = val;
+    } else if (key == "log") {
+        c.log = val;
+    } else if (key == "max_files" || key == "max_bytes" || key == "max_ms") {
+        if (!parse_size(val, n))
+            bad("size");
+        else if (key == "max_files")
+            budget.max_files = n;
+        else if (key == "max_bytes")
+            budget.max_bytes = n;
+        else
+            budget.max_ms = static_cast<unsigned>(n);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parse_config(const std::string &conf_path, Config &out) {
     std::ifstream in(conf_path);
     if (!in) {
-        syslog(LOG_ERR, "cannot open config: %s", conf_path.c_str());
-        return out;
+        log_msg(LOG_ERR, "cannot open config: %s", conf_path.c_str());
+        return false;
     }
+    Config c;
+    Budget budget;
+    std::vector<std::pair<size_t, std::string>> rule_lines;
     fs::path conf_dir = fs::absolute(fs::path(conf_path)).parent_path();
     std::string line;
     size_t lineno = 0;
@@ -23,21 +248,21 @@ std::vector<Rule> load_config(const std::string &conf_path) {
         if (auto pos = line.find('#'); pos != std::string::npos)
             line.erase(pos);
         
-        if (line.find_first_not_of(" \t\r\n") == std::string::npos)
+        std::istringstream iss(line);
+        std::string key, val;
+        if (!(iss >> key))
             continue;
+        iss >> val;
+        if (!parse_option(key, val, lineno, c, budget))
+            rule_lines.emplace_back(lineno, line);
+    }
 
-        std::istringstream iss(line);
+    // Правила — после всего файла: бюджет по умолчанию может стоять ниже них.
+    for (const auto &[no, text] : rule_lines) {
+        std::istringstream iss(text);
         std::string f1, f2, ext;
-
-        {
-            std::istringstream t(line);
-            std::string key; t >> key;
-            if (key == "interval")
-                continue;
-        }
-
         if (!(iss >> f1 >> f2 >> ext)) {
-            syslog(LOG_WARNING, "bad config line %zu: expected '<from> <to> <ext>'", lineno);
+            log_msg(LOG_WARNING, "bad config line %zu: expected '<from> <to> <ext[,ext...]> [key=value...]'", no);
             continue;
         }
 
@@ -48,56 +273,165 @@ std::vector<Rule> load_config(const std::string &conf_path) {
             r.from = fs::absolute(conf_dir / r.from);
         if (!r.to.is_absolute())
             r.to = fs::absolute(conf_dir / r.to);
-        if (!ext.empty() && ext.front() == '.')
-            ext.erase(0, 1);
-        if (ext.empty()) {
-            syslog(LOG_WARNING, "config line %zu: empty extension", lineno);
+        std::string err;
+        if (!r.match.compile(ext, err)) {
+            log_msg(LOG_WARNING, "config line %zu: %s", no, err.c_str());
             continue;
         }
-        r.ext = to_lower(ext);
+        r.spec = ext;
+        r.budget = budget;
+        r.ioprio = c.ioprio;
+        r.jitter = c.jitter;
 
-        if (!fs::exists(r.from) || !fs::is_directory(r.from)) {
-            syslog(LOG_WARNING, "config line %zu: source not exists or not a directory: %s", lineno, r.from.c_str());
-            continue;
+        bool opts_ok = true;
+        for (std::string tok; opts_ok && iss >> tok; ) {
+            if (!parse_rule_option(tok, r, err)) {
+                log_msg(LOG_WARNING, "config line %zu: %s", no, err.c_str());
+                opts_ok = false;
+            }
         }
-
-        std::error_code ec;
-        fs::create_directories(r.to, ec);
-        if (ec || !fs::is_directory(r.to)) {
-            syslog(LOG_WARNING, "config line %zu: cannot create target dir %s: %s", lineno, r.to.c_str(), ec.message().c_str());
-            continue;
+        for (fs::path &d : r.fanout)
+            if (!d.is_absolute())
+                d = fs::absolute(conf_dir / d);
+        if (opts_ok && !r.fanout.empty() && (r.tree != TreeMode::Flat || r.dedupe != Dedupe::Off)) {
+            log_msg(LOG_WARNING, "config line %zu: fanout works only without recursive= and dedupe=", no);
+            opts_ok = false;
         }
-
-        out.push_back(std::move(r));
+        for (auto it = r.fanout.begin(); opts_ok && it != r.fanout.end(); ++it)
+            if (*it == r.to || std::find(r.fanout.begin(), it, *it) != it) {
+                log_msg(LOG_WARNING, "config line %zu: fanout lists %s twice", no, it->c_str());
+                opts_ok = false;
+            }
+        if (opts_ok)
+            c.rules.push_back(std::move(r));
     }
-    syslog(LOG_INFO, "config loaded: %zu rule(s)", out.size());
-    return out;
+    if (c.interval == 0)
+        log_msg(LOG_ERR, "missing 'interval' in config");
+    out = std::move(c);
+    return true;
 }
 
-bool try_load_interval(const std::string &conf_path, int &out) {
-    std::ifstream in(conf_path);
-    if (!in) {
-        syslog(LOG_ERR, "cannot open config: %s", conf_path.c_str());
+std::string Rule::key() const {
+    char opts[160];
+    std::snprintf(opts, sizeof(opts), "%zu/%llu/%u/%d/%u/%d", budget.max_files, (unsigned long long)budget.max_bytes,
+                  budget.max_ms, static_cast<int>(tree), max_depth, static_cast<int>(dedupe));
+    std::string k = from.string();
+    k.append(1, '\0').append(to.string()).append(1, '\0').append(spec).append(1, '\0').append(opts);
+    for (const fs::path &d : fanout)
+        k.append(1, '\0').append(d.string());
+    return k;
+}
+
+// Проверка источника и создание назначения — то, что дорого повторять на каждом SIGHUP.
+static bool prepare_rule(Rule &r) {
+    struct stat st{};
+    if (stat(r.from.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        log_msg(LOG_WARNING, "source not exists or not a directory: %s", r.from.c_str());
         return false;
     }
-    std::string line;
-    size_t lineno = 0;
-    while (std::getline(in, line)) {
-        ++lineno;
-        if (auto pos = line.find('#'); pos != std::string::npos) line.erase(pos);
-        if (line.find_first_not_of(" \t\r\n") == std::string::npos) continue;
+    std::error_code ec;
+    fs::create_directories(r.to, ec);
+    if (ec || !fs::is_directory(r.to)) {
+        log_msg(LOG_WARNING, "cannot create target dir %s: %s", r.to.c_str(), ec.message().c_str());
+        return false;
+    }
+    for (const fs::path &d : r.fanout) {
+        fs::create_directories(d, ec);
+        if (ec || !fs::is_directory(d)) {
+            log_msg(LOG_WARNING, "cannot create fanout dir %s: %s", d.c_str(), ec.message().c_str());
+            return false;
+        }
+    }
+    r.state = std::make_shared<RuleState>(r.from, r.to);
+    for (const fs::path &d : r.fanout)
+        r.state->fanout.push_back(std::make_unique<DestIndex>(d));
+    r.state->src_dev = st.st_dev;
+    r.state->src_ino = st.st_ino;
+    return true;
+}
 
-        std::istringstream iss(line);
-        std::string key;
-        if (!(iss >> key)) continue;
+size_t prepare_rules(std::vector<Rule> &fresh, std::vector<Rule> &old) {
+    std::unordered_map<std::string, Rule *> by_key;
+    for (Rule &r : old)
+        if (r.state)
+            by_key.emplace(r.key(), &r);
+    size_t kept = 0;
+    std::vector<Rule> out;
+    out.reserve(fresh.size());
+    for (Rule &r : fresh) {
+        auto it = by_key.find(r.key());
+        if (it != by_key.end()) {
+            r.state = std::move(it->second->state);
+            r.slot = it->second->slot;
+            by_key.erase(it); // дубликат строки в конфиге получит своё состояние
+            ++kept;
+        } else if (!prepare_rule(r)) {
+            continue;
+        }
+        r.state->bytes_rate.set_rate(r.rate.bytes);
+        r.state->ops_rate.set_rate(r.rate.ops);
+        out.push_back(std::move(r));
+    }
+    fresh = std::move(out);
+    return kept;
+}
 
-        if (key == "interval") {
-            int v = 0;
-            if ((iss >> v) && v > 0) { out = v; return true; }
-            syslog(LOG_WARNING, "bad 'interval' at line %zu: expected positive integer", lineno);
-            return false;
+std::vector<Rule> load_config(const std::string &conf_path) {
+    Config c;
+    std::vector<Rule> none;
+    if (!parse_config(conf_path, c))
+        return none;
+    prepare_rules(c.rules, none);
+    log_msg(LOG_INFO, "config loaded: %zu rule(s)", c.rules.size());
+    return std::move(c.rules);
+}
+
+std::vector<SourceGroup> group_by_source(const std::vector<Rule> &rules, const std::vector<SourceGroup> &prev) {
+    std::vector<SourceGroup> out;
+    std::map<std::pair<dev_t, ino_t>, size_t> seen;
+    for (const auto &r : rules) {
+        if (!r.state)
+            continue;
+        auto [it, fresh] = seen.try_emplace({r.state->src_dev, r.state->src_ino}, out.size());
+        if (fresh) {
+            SourceGroup g;
+            g.from = r.from;
+            g.dev = r.state->src_dev;
+            out.push_back(std::move(g));
         }
+        out[it->second].rules.push_back(&r);
     }
-    syslog(LOG_ERR, "missing 'interval' in config");
-    return false;
-}
\ No newline at end of file
+    for (SourceGroup &g : out)
+        for (const SourceGroup &p : prev)
+            if (p.from == g.from) {
+                g.cursor = p.cursor;
+                g.backlog = p.backlog;
+                g.tick = p.tick;
+                g.due_ms = p.due_ms;
+                break;
+            }
+    return out;
+}
+
+bool parse_size(const std::string &s, uint64_t &out) {
+    if (s.empty() || s[0] < '0' || s[0] > '9')
+        return false;
+    size_t pos = 0;
+    unsigned long long v = 0;
+    try {
+        v = std::stoull(s, &pos);
+    } catch (...) {
+        return false;
+    }
+    std::string suf = to_lower(s.substr(pos));
+    if (suf == "k")
+        v <<= 10;
+    else if (suf == "m")
+        v <<= 20;
+    else if (suf == "g")
+        v <<= 30;
+    else if (!suf.empty())
+        return false;
+    out = v;
+    return true;
+}
@@ -1,16 +1,144 @@
 #pragma once
 
+#include "commit.h"
+#include "dest_index.h"
+#include "dir_fd.h"
+#include "matcher.h"
+#include "schedule.h"
+#include "throttle.h"
+
+#include <sys/types.h>
+
+#include <atomic>
 #include <filesystem>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace fs = std::filesystem;
 
+// Сколько работы правило может сделать за один тик; 0 — без ограничения.
+// Остаток переходит на следующие тики с места, где остановились.
+struct Budget {
+    size_t max_files = 0;
+    uint64_t max_bytes = 0; // байт, скопированных на другое устройство
+    unsigned max_ms = 0;
+};
+
+// Ограничение скорости: байт (копирование на другое устройство) и операций
+// (перенос или удаление файла) в секунду; 0 — без ограничения.
+struct Rate {
+    uint64_t bytes = 0;
+    uint64_t ops = 0;
+};
+
+// Как правило обходит подкаталоги источника.
+enum class TreeMode {
+    Flat,    // только сам каталог from (по умолчанию)
+    Mirror,  // поддерево переносится с той же структурой каталогов
+    Flatten, // файлы из всего поддерева складываются прямо в to
+};
+
+// Что делать с файлом, содержимое которого уже есть в каталоге назначения.
+enum class Dedupe {
+    Off,  // переносить как обычно (с суффиксом имени при коллизии)
+    Drop, // удалить источник
+    Link, // жёсткая ссылка на имеющийся файл под именем источника
+};
+
+// То, что правило накапливает между тиками. При перечитывании конфига
+// неизменённые правила переносят его в новый набор как есть.
+struct RuleState {
+    RuleState(const fs::path &from, const fs::path &to) : from(from), dest(to) {}
+
+    dev_t src_dev = 0; // каталог from, как он был при подготовке правила
+    ino_t src_ino = 0;
+    DirFd from;        // дескриптор from для *at()-вызовов; сверяется с путём раз в проход
+    DestIndex dest;    // индекс имён to; используется одним потоком за раз
+    std::vector<std::unique_ptr<DestIndex>> fanout; // индексы Rule::fanout, в том же порядке
+    TokenBucket bytes_rate, ops_rate;
+    // Управляющий сокет: paused задаёт он, busy и backlog — для его status.
+    std::atomic<bool> paused{false}; // файлы правила остаются на месте до resume
+    std::atomic<bool> busy{false};   // источник правила сейчас обрабатывается
+    std::atomic<bool> backlog{false};
+};
+
 struct Rule {
     fs::path from;
     fs::path to;
-    std::string ext; // без точки, в нижнем регистре
+    std::vector<fs::path> fanout; // ещё назначения: файл доставляется в to и в каждое из них
+    std::string spec; // фильтр в том виде, как он записан в конфиге
+    Matcher match;
+    Budget budget;
+    TreeMode tree = TreeMode::Flat;
+    unsigned max_depth = 64; // глубина от from; сам from — уровень 0
+    Dedupe dedupe = Dedupe::Off;
+    Rate rate;
+    int ioprio = -1; // класс ввода-вывода потока на время правила; -1 — не менять
+    int interval = 0; // свой период планового прохода; 0 — общий interval
+    int jitter = 0;   // случайная добавка к периоду, секунды
+    Window window;    // вне окна правило стоит, как на паузе
+    int slot = -1; // номер в блоке метрик
+    std::shared_ptr<RuleState> state; // nullptr — правило ещё не подготовлено
+
+    // Всё, что задаёт поведение правила: совпадение ключей — то же правило.
+    // Лимиты скорости, ioprio и расписание сюда не входят — их смена не сбрасывает состояние.
+    std::string key() const;
+};
+
+// Таблица диспетчеризации: правила с общим каталогом-источником. Каталог читается
+// один раз за тик, файл достаётся первому подходящему правилу в порядке конфига.
+struct SourceGroup {
+    fs::path from;
+    dev_t dev = 0;
+    std::vector<const Rule*> rules;
+    // Курсор по inode: следующий проход начинается с него (по кругу), если
+    // прошлый упёрся в бюджет или был прерван сигналом.
+    uint64_t cursor = 0;
+    bool backlog = false;
+    size_t moved = 0; // за последний проход
+    // Расписание: период с учётом хвоста и срок следующего прохода (монотонные мс).
+    int tick = 0;
+    int64_t due_ms = 0;
 };
 
+// Весь конфиг, разобранный за одно чтение файла. Правила ещё не подготовлены:
+// каталоги не проверены и не созданы (это делает prepare_rules).
+struct Config {
+    int interval = 0; // 0 — нет или неверный; без него демон не стартует
+    int min_interval = 1;
+    bool watch = false;
+    bool auto_reload = false;
+    bool fixed_rate = false; // тики от начала прошлого прохода, а не от его конца
+    int jitter = 0;          // по умолчанию для правил
+    int workers = 1;
+    int device_workers = 1;
+    int tree_workers = 0; // 0 — ядра поровну между workers
+    int processes = 1;    // >1 — мастер и столько процессов-обработчиков
+    uint64_t chunked_min = 256ull << 20; // файлы от этого размера копируются кусками; 0 — никогда
+    int copy_threads = 4;
+    bool direct_io = false;
+    CommitOptions commit; // durability, commit_files, commit_ms
+    Rate rate;      // общий лимит процесса
+    int ioprio = -1; // по умолчанию для правил
+    std::string backend = "sync";
+    std::string metrics;  // пусто — /dev/shm/<tag>.metrics
+    std::string log = "syslog";
+    std::vector<Rule> rules;
+};
+
+bool parse_config(const std::string &conf_path, Config &out);
+
+// Переносит в fresh состояние и слоты метрик правил из old с тем же key();
+// остальные правила fresh готовит заново (проверка from, создание to) и
+// выбрасывает неудачные. Возвращает число перенесённых правил.
+size_t prepare_rules(std::vector<Rule> &fresh, std::vector<Rule> &old);
+
+// Указатели в группах ссылаются на элементы rules — перестраивать вместе.
+// Курсоры и хвосты переносятся из prev по каталогу-источнику.
+std::vector<SourceGroup> group_by_source(const std::vector<Rule> &rules, const std::vector<SourceGroup> &prev = {});
+
+// Разбор и подготовка правил (для стенда и тестовых прогонов).
 std::vector<Rule> load_config(const std::string &conf_path);
-bool try_load_interval(const std::string &conf_path, int &out);
\ No newline at end of file
+// Размер с необязательным суффиксом K/M/G (степени 1024).
+bool parse_size(const std::string &s, uint64_t &out);
@@ -0,0 +1,295 @@
+#include "content_index.h"
+#include "dir_scanner.h"
+#include "log.h"
+#include "xxhash64.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+static constexpr size_t kChunk = 1 << 20;
+
+bool fingerprint_stat(int fd, Fingerprint &fp) {
+    struct stat sb{};
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode))
+        return false;
+    fp.size = static_cast<uint64_t>(sb.st_size);
+    fp.mtime_ns = int64_t(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+    return true;
+}
+
+// Большие файлы хешируются кусками по kChunk: память постоянна, а голова
+// (первые kHeadBytes) отсекает почти все несовпадения без чтения остального.
+bool fingerprint_hash(int fd, Fingerprint &fp, bool need_full) {
+    thread_local std::vector<unsigned char> buf(kChunk);
+    if (!fp.has_head) {
+        size_t want = static_cast<size_t>(std::min<uint64_t>(fp.size, ContentIndex::kHeadBytes));
+        ssize_t n = pread(fd, buf.data(), want, 0);
+        if (n < 0 || size_t(n) != want)
+            return false;
+        fp.head = xxh64(buf.data(), want);
+        fp.has_head = true;
+        if (fp.size <= ContentIndex::kHeadBytes) {
+            fp.full = fp.head;
+            fp.has_full = true;
+        }
+    }
+    if (!need_full || fp.has_full)
+        return true;
+
+    Xxh64 h;
+    uint64_t off = 0;
+    while (off < fp.size) {
+        ssize_t n = pread(fd, buf.data(), buf.size(), static_cast<off_t>(off));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        h.update(buf.data(), size_t(n));
+        off += uint64_t(n);
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    fp.full = h.digest();
+    fp.has_full = true;
+    return true;
+}
+
+// Хеши могут совпасть и у разных файлов: перед тем как выбросить источник,
+// содержимое сверяется целиком.
+static bool same_bytes(int a, int b, uint64_t size) {
+    thread_local std::vector<unsigned char> ba(kChunk), bb(kChunk);
+    for (uint64_t off = 0; off < size; ) {
+        size_t want = static_cast<size_t>(std::min<uint64_t>(kChunk, size - off));
+        ssize_t na = pread(a, ba.data(), want, static_cast<off_t>(off));
+        ssize_t nb = pread(b, bb.data(), want, static_cast<off_t>(off));
+        if (na != ssize_t(want) || nb != ssize_t(want) || std::memcmp(ba.data(), bb.data(), want) != 0)
+            return false;
+        off += want;
+    }
+    return true;
+}
+
+std::shared_ptr<ContentIndex> ContentIndex::of(const fs::path &dir) {
+    static std::mutex mu;
+    // Живут до конца процесса: каталог сверяется с диском один раз, дальше
+    // индекс поддерживается по ходу переноса.
+    static std::map<std::string, std::shared_ptr<ContentIndex>> cache;
+    std::lock_guard<std::mutex> lk(mu);
+    auto &slot = cache[dir.string()];
+    if (!slot) {
+        slot.reset(new ContentIndex(dir));
+        slot->load();
+    }
+    return slot;
+}
+
+// Формат: строка "lab1d-dedupe 1", затем "size mtime_ns flags head full name",
+// числа в hex, flags: 1 — есть head, 2 — есть full. Имя — до конца строки.
+void ContentIndex::load() {
+    std::map<std::string, Fingerprint> saved;
+    std::ifstream in(dir_ / kFileName);
+    std::string line;
+    if (in && std::getline(in, line) && line == "lab1d-dedupe 1") {
+        while (std::getline(in, line)) {
+            std::istringstream iss(line);
+            Fingerprint fp;
+            unsigned flags = 0;
+            if (!(iss >> std::hex >> fp.size >> fp.mtime_ns >> flags >> fp.head >> fp.full))
+                continue;
+            iss.get();
+            std::string name;
+            std::getline(iss, name);
+            fp.has_head = flags & 1;
+            fp.has_full = flags & 2;
+            if (!name.empty())
+                saved[name] = fp;
+        }
+    }
+
+    // Сверка с каталогом: новые файлы попадают в индекс без хешей,
+    // у изменённых хеши сбрасываются, пропавшие выпадают.
+    int dfd = open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0)
+        return;
+    ScanInfo info;
+    size_t kept = 0;
+    scan_dir_each(dir_, [&](uint64_t, unsigned char type, const char *name, size_t len) {
+        if (type != DT_REG || name[0] == '.')
+            return;
+        struct stat sb{};
+        if (fstatat(dfd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(sb.st_mode))
+            return;
+        Entry e{std::string(name, len), {}};
+        e.fp.size = uint64_t(sb.st_size);
+        e.fp.mtime_ns = int64_t(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+        auto it = saved.find(e.name);
+        if (it != saved.end() && it->second.size == e.fp.size && it->second.mtime_ns == e.fp.mtime_ns) {
+            e.fp = it->second;
+            ++kept;
+        } else
+            dirty_ = true;
+        by_size_[e.fp.size].push_back(std::move(e));
+    }, info);
+    close(dfd);
+    if (kept != saved.size())
+        dirty_ = true;
+}
+
+// Запись всё ещё описывает файл на диске; иначе обновляется или помечается пустым именем.
+bool ContentIndex::fresh(Entry &e) const {
+    struct stat sb{};
+    if (fstatat(AT_FDCWD, (dir_ / e.name).c_str(), &sb, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(sb.st_mode)
+        || uint64_t(sb.st_size) != e.fp.size) {
+        e.name.clear();
+        return false;
+    }
+    int64_t mt = int64_t(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+    if (mt != e.fp.mtime_ns) {
+        e.fp.mtime_ns = mt;
+        e.fp.has_head = e.fp.has_full = false;
+    }
+    return true;
+}
+
+// Посчитанное одним потоком не затирает посчитанное другим, пока файл тот же.
+static bool merge(Fingerprint &into, const Fingerprint &from) {
+    if (into.mtime_ns != from.mtime_ns) {
+        into = from;
+        return true;
+    }
+    bool changed = false;
+    if (from.has_head && !into.has_head) {
+        into.head = from.head;
+        into.has_head = changed = true;
+    }
+    if (from.has_full && !into.has_full) {
+        into.full = from.full;
+        into.has_full = changed = true;
+    }
+    return changed;
+}
+
+bool ContentIndex::find(const fs::path &src, Fingerprint &fp, std::string &same) {
+    // Кандидаты копируются под мьютексом, а сверяются и хешируются без него:
+    // иначе потоки правила ждали бы друг друга на чтении целых файлов.
+    std::vector<Entry> list;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto bucket = by_size_.find(fp.size);
+        if (bucket == by_size_.end())
+            return false; // размер уникален — читать файл не нужно
+        list = bucket->second;
+    }
+    std::vector<std::string> names;
+    for (const Entry &e : list)
+        names.push_back(e.name);
+
+    int sfd = -1;
+    auto src_fd = [&]() {
+        if (sfd < 0)
+            sfd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+        return sfd;
+    };
+    bool found = false;
+    for (auto &e : list) {
+        if (!fresh(e))
+            continue;
+        if (!fp.has_head && (src_fd() < 0 || !fingerprint_hash(sfd, fp, false)))
+            break;
+        int dfd = -1;
+        if (!e.fp.has_head) {
+            dfd = open((dir_ / e.name).c_str(), O_RDONLY | O_CLOEXEC);
+            if (dfd < 0)
+                continue;
+            if (!fingerprint_hash(dfd, e.fp, false)) {
+                close(dfd);
+                continue;
+            }
+        }
+        if (e.fp.head != fp.head) {
+            if (dfd >= 0)
+                close(dfd);
+            continue;
+        }
+        if (dfd < 0)
+            dfd = open((dir_ / e.name).c_str(), O_RDONLY | O_CLOEXEC);
+        bool match = dfd >= 0 && fingerprint_hash(src_fd(), fp, true) && fingerprint_hash(dfd, e.fp, true)
+            && e.fp.full == fp.full && same_bytes(sfd, dfd, fp.size);
+        if (dfd >= 0)
+            close(dfd);
+        if (match) {
+            same = e.name;
+            found = true;
+            break;
+        }
+    }
+    if (sfd >= 0)
+        close(sfd);
+
+    // Обратно в индекс: посчитанные хеши и пропавшие файлы.
+    std::lock_guard<std::mutex> lk(mu_);
+    auto bucket = by_size_.find(fp.size);
+    if (bucket == by_size_.end())
+        return found;
+    auto &entries = bucket->second;
+    for (size_t i = 0; i < list.size(); ++i) {
+        auto it = std::find_if(entries.begin(), entries.end(), [&](const Entry &x) { return x.name == names[i]; });
+        if (it == entries.end())
+            continue;
+        if (list[i].name.empty()) {
+            it->name.clear();
+            dirty_ = true;
+        } else if (merge(it->fp, list[i].fp)) {
+            dirty_ = true;
+        }
+    }
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entry &e) { return e.name.empty(); }), entries.end());
+    return found;
+}
+
+void ContentIndex::add(const std::string &name, const Fingerprint &fp) {
+    std::lock_guard<std::mutex> lk(mu_);
+    by_size_[fp.size].push_back(Entry{name, fp});
+    dirty_ = true;
+}
+
+void ContentIndex::save() {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!dirty_)
+        return;
+    fs::path path = dir_ / kFileName;
+    fs::path tmp = path;
+    tmp += ".part";
+    FILE *f = std::fopen(tmp.c_str(), "w");
+    if (!f) {
+        log_msg(LOG_WARNING, "dedupe index %s: %m", tmp.c_str());
+        return;
+    }
+    std::fprintf(f, "lab1d-dedupe 1\n");
+    for (const auto &[size, list] : by_size_)
+        for (const auto &e : list) {
+            if (e.name.find('\n') != std::string::npos)
+                continue;
+            unsigned flags = (e.fp.has_head ? 1 : 0) | (e.fp.has_full ? 2 : 0);
+            std::fprintf(f, "%" PRIx64 " %" PRIx64 " %x %" PRIx64 " %" PRIx64 " %s\n", size, uint64_t(e.fp.mtime_ns), flags,
+                         e.fp.head, e.fp.full, e.name.c_str());
+        }
+    bool ok = std::fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        log_msg(LOG_WARNING, "dedupe index %s: %m", path.c_str());
+        unlink(tmp.c_str());
+        return;
+    }
+    dirty_ = false;
+}
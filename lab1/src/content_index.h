@@ -0,0 +1,62 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Отпечаток содержимого: размер, XXH64 первых kHeadBytes и всего файла.
+// Хеши считаются лениво — только когда нашёлся файл того же размера.
+struct Fingerprint {
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    uint64_t head = 0, full = 0;
+    bool has_head = false, has_full = false;
+};
+
+// Индекс содержимого каталога назначения для dedupe=. Хранится в самом каталоге
+// (.lab1d-dedupe.idx), в памяти — один экземпляр на каталог на весь процесс.
+// Записи сверяются с диском по размеру и mtime перед тем, как им поверить.
+class ContentIndex {
+public:
+    static std::shared_ptr<ContentIndex> of(const fs::path &dir);
+
+    const fs::path &dir() const { return dir_; }
+
+    // Имя файла каталога с тем же содержимым, что у src (побайтно); fp — отпечаток
+    // src, дополняется посчитанными хешами и годится для последующего add().
+    bool find(const fs::path &src, Fingerprint &fp, std::string &same);
+    void add(const std::string &name, const Fingerprint &fp);
+    // Пишет индекс на диск, если он менялся (через временный файл и rename).
+    void save();
+
+    static constexpr size_t kHeadBytes = 64 * 1024;
+    static constexpr const char *kFileName = ".lab1d-dedupe.idx";
+
+private:
+    struct Entry {
+        std::string name;
+        Fingerprint fp;
+    };
+
+    explicit ContentIndex(fs::path dir) : dir_(std::move(dir)) {}
+    void load();
+    bool fresh(Entry &e) const;
+
+    fs::path dir_;
+    std::mutex mu_;
+    bool dirty_ = false;
+    std::unordered_map<uint64_t, std::vector<Entry>> by_size_;
+};
+
+// Заполняет size/mtime по stat; false — не обычный файл.
+bool fingerprint_stat(int fd, Fingerprint &fp);
+// Досчитывает head/full (full — только если need_full).
+bool fingerprint_hash(int fd, Fingerprint &fp, bool need_full);
@@ -0,0 +1,237 @@
+#include "control.h"
+#include "log.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+static constexpr size_t kMaxConns = 16;
+static constexpr size_t kMaxLine = 4096;
+
+static bool fill_addr(const std::string &path, sockaddr_un &addr) {
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+static bool write_all(int fd, const std::string &s) {
+    size_t off = 0;
+    while (off < s.size()) {
+        ssize_t n = send(fd, s.data() + off, s.size() - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        off += size_t(n);
+    }
+    return true;
+}
+
+// Итоговая строка ответа — последняя, начинается с "ok" или "error".
+static bool reply_complete(const std::string &reply) {
+    if (reply.empty() || reply.back() != '\n')
+        return false;
+    size_t start = reply.rfind('\n', reply.size() - 2);
+    start = start == std::string::npos ? 0 : start + 1;
+    return reply.compare(start, 2, "ok") == 0 || reply.compare(start, 5, "error") == 0;
+}
+
+ControlServer::~ControlServer() {
+    stop();
+}
+
+bool ControlServer::start(const std::string &path, ControlHandler fn) {
+    stop();
+    sockaddr_un addr;
+    if (!fill_addr(path, addr)) {
+        log_msg(LOG_WARNING, "control: socket path too long: %s", path.c_str());
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_msg(LOG_WARNING, "control: socket: %m");
+        return false;
+    }
+    unlink(path.c_str());
+    mode_t old_mask = umask(077);
+    int rc = bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    umask(old_mask);
+    if (rc != 0 || listen(fd, int(kMaxConns)) != 0) {
+        log_msg(LOG_WARNING, "control: listen %s: %m", path.c_str());
+        close(fd);
+        return false;
+    }
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd_ < 0) {
+        log_msg(LOG_WARNING, "control: eventfd: %m");
+        close(fd);
+        unlink(path.c_str());
+        return false;
+    }
+    path_ = path;
+    fn_ = std::move(fn);
+    listen_fd_ = fd;
+    thread_ = std::thread(&ControlServer::accept_loop, this);
+    return true;
+}
+
+void ControlServer::stop() {
+    if (listen_fd_ < 0)
+        return;
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0)
+        log_msg(LOG_WARNING, "control: wake: %m");
+    thread_.join();
+    reap(true);
+    close(listen_fd_);
+    close(wake_fd_);
+    listen_fd_ = wake_fd_ = -1;
+    unlink(path_.c_str());
+}
+
+void ControlServer::after_fork() {
+    if (listen_fd_ < 0)
+        return;
+    close(listen_fd_);
+    close(wake_fd_);
+    listen_fd_ = wake_fd_ = -1;
+    for (Conn *c : conns_)
+        if (!c->done)
+            close(c->fd);
+    // как в log_after_fork: потоки здесь не существуют, мьютекс мог быть захвачен
+    new (&thread_) std::thread();
+    new (&mu_) std::mutex();
+    conns_.clear();
+}
+
+// Завершённые соединения; all — все, после сигнала остановки.
+void ControlServer::reap(bool all) {
+    std::vector<Conn *> gone;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        for (auto it = conns_.begin(); it != conns_.end(); ) {
+            if (all || (*it)->done) {
+                gone.push_back(*it);
+                it = conns_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (Conn *c : gone) {
+        c->thread.join();
+        delete c;
+    }
+}
+
+void ControlServer::accept_loop() {
+    for (;;) {
+        struct pollfd pfd[2] = {{listen_fd_, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            log_msg(LOG_ERR, "control: poll: %m");
+            return;
+        }
+        if (pfd[1].revents)
+            return;
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        reap(false);
+        std::lock_guard<std::mutex> lk(mu_);
+        if (conns_.size() >= kMaxConns) {
+            write_all(fd, "error too many connections\n");
+            close(fd);
+            continue;
+        }
+        Conn *c = new Conn;
+        c->fd = fd;
+        conns_.push_back(c);
+        c->thread = std::thread(&ControlServer::serve, this, c);
+    }
+}
+
+void ControlServer::serve(Conn *c) {
+    std::string buf, reply;
+    char chunk[1024];
+    for (bool open = true; open; ) {
+        struct pollfd pfd[2] = {{c->fd, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (pfd[1].revents)
+            break;
+        ssize_t n = recv(c->fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        buf.append(chunk, size_t(n));
+        size_t eol;
+        while (open && (eol = buf.find('\n')) != std::string::npos) {
+            std::string line = buf.substr(0, eol);
+            buf.erase(0, eol + 1);
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.empty())
+                continue;
+            reply.clear();
+            fn_(line, reply);
+            if (!reply_complete(reply))
+                reply += "error no reply\n";
+            open = write_all(c->fd, reply);
+        }
+        if (buf.size() > kMaxLine) {
+            write_all(c->fd, "error line too long\n");
+            break;
+        }
+    }
+    close(c->fd);
+    std::lock_guard<std::mutex> lk(mu_);
+    c->done = true;
+}
+
+bool control_request(const std::string &path, const std::string &cmd, std::string &reply, int timeout_ms) {
+    reply.clear();
+    sockaddr_un addr;
+    if (!fill_addr(path, addr))
+        return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || !write_all(fd, cmd + "\n")) {
+        close(fd);
+        return false;
+    }
+    char chunk[4096];
+    while (!reply_complete(reply)) {
+        struct pollfd pfd{fd, POLLIN, 0};
+        int rc = poll(&pfd, 1, timeout_ms);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            break;
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        reply.append(chunk, size_t(n));
+    }
+    close(fd);
+    return reply_complete(reply);
+}
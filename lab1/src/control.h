@@ -0,0 +1,53 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Управляющий сокет (Unix, поток байт). Команда — одна строка; ответ — строки
+// данных и итоговая строка, начинающаяся с "ok" или "error". На одном
+// соединении можно слать команды подряд. Каждое соединение обслуживает свой
+// поток, так что долгий "scan wait" не мешает параллельному "status".
+using ControlHandler = std::function<void(const std::string &cmd, std::string &reply)>;
+
+class ControlServer {
+public:
+    ControlServer() = default;
+    ~ControlServer();
+    ControlServer(const ControlServer &) = delete;
+    ControlServer &operator=(const ControlServer &) = delete;
+
+    bool start(const std::string &path, ControlHandler fn);
+    // Закрывает сокет и дожидается соединений; обработчик должен сам вернуться
+    // вскоре после остановки демона.
+    void stop();
+    // В дочернем процессе после fork(): потоков родителя там нет — только
+    // закрыть унаследованные дескрипторы.
+    void after_fork();
+    bool active() const { return listen_fd_ >= 0; }
+
+private:
+    struct Conn {
+        int fd = -1;
+        bool done = false;
+        std::thread thread;
+    };
+
+    void accept_loop();
+    void serve(Conn *c);
+    void reap(bool all);
+
+    std::string path_;
+    ControlHandler fn_;
+    int listen_fd_ = -1;
+    int wake_fd_ = -1; // eventfd остановки для accept и соединений
+    std::thread thread_;
+    std::mutex mu_;
+    std::vector<Conn *> conns_;
+};
+
+// Клиент: одна команда, ответ целиком (до итоговой строки). false — сокет
+// недоступен или ответ не пришёл за timeout_ms (-1 — ждать сколько угодно).
+bool control_request(const std::string &path, const std::string &cmd, std::string &reply, int timeout_ms);
@@ -1,13 +1,32 @@
 #include "daemon.h"
 
+#include "commit.h"
 #include "config.h"
 #include "daemon_utils.h"
 #include "file_worker.h"
+#include "log.h"
+#include "metrics.h"
+#include "shard.h"
+#include "state_file.h"
+#include "throttle.h"
+#include "transfer.h"
+#include "utils.h"
+#include "xxhash64.h"
 
-#include <syslog.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <signal.h>
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <new>
+#include <thread>
 
 Daemon& Daemon::instance() {
     static Daemon d;
@@ -16,7 +35,7 @@ Daemon& Daemon::instance() {
 
 void Daemon::init(const std::string& cfg, const std::string& pid, const std::string& tag) {
     if (initialized_) {
-        syslog(LOG_WARNING, "daemon reinit ignored: already initialized");
+        log_msg(LOG_WARNING, "daemon reinit ignored: already initialized");
         return;
     }
     config_path = cfg;
@@ -28,59 +47,1273 @@ void Daemon::init(const std::string& cfg, const std::string& pid, const std::str
 void Daemon::run() {
     openlog(log_tag.c_str(), LOG_PID, LOG_USER);
 
-    rules = load_config(config_path);
-    if (!try_load_interval(config_path, interval_sec)) {
-        syslog(LOG_ERR, "cannot start without valid 'interval'");
+    Config c;
+    if (!parse_config(config_path, c) || c.interval == 0) {
+        log_msg(LOG_ERR, "cannot start without valid 'interval'");
         std::fprintf(stderr, "lab1d: cannot start without valid 'interval' in %s\n", config_path.c_str());
         closelog();
         _exit(2);
     }
+    processes = c.processes;
+    apply_config(std::move(c));
+    worker_opt.stop = &stop;
+    worker_opt.reload = &reload;
 
-    ensure_singleton(pid_path);
     daemonize();
+    // до первого потока: сигналы приходят только через signalfd реактора
+    install_signals();
 
     closelog();
     openlog(log_tag.c_str(), LOG_PID, LOG_USER);
+    // после fork: поток писателя должен жить в процессе демона
+    log_start(log_tag, log_sink);
 
-    install_signals();
+    // Конфиг разобран и каталоги подготовлены заранее: прежний экземпляр
+    // останавливается, только когда новому осталось лишь продолжить.
+    supervisor = processes > 1;
+    Handover h;
+    if (!take_over(h)) {
+        // без блокировки pid-файла рядом может работать второй экземпляр
+        log_stop();
+        closelog();
+        _exit(1);
+    }
+    write_pid(pid_fd);
+    handover_fd = handover_listen(pid_path + ".sock");
+    open_metrics();
+    assign_slots();
+    restore_state();
+    adopt(h);
+    start_control();
+    if (supervisor)
+        supervise();
+    else
+        serve();
+    control.stop();
+
+    if (handover)
+        hand_over();
+    watcher.close();
+    state_close();
+    metrics_close();
+    LogStats ls = log_stats();
+    log_msg(LOG_INFO, "stopped%s; log: written=%llu suppressed=%llu dropped=%llu", handed_over ? " after handover" : "",
+            (unsigned long long)ls.written, (unsigned long long)ls.suppressed, (unsigned long long)ls.dropped);
+    // после передачи дел pid-файл и сокет уже принадлежат новому экземпляру
+    if (!handed_over) {
+        unlink(pid_path.c_str());
+        if (handover_fd >= 0)
+            unlink((pid_path + ".sock").c_str());
+    }
+    if (handover_fd >= 0)
+        close(handover_fd);
+    log_stop();
+    closelog();
+    // блокировка pid-файла снимается последней — новый экземпляр ждёт именно её
+    if (pid_fd >= 0)
+        close(pid_fd);
+}
+
+// pid-файл под flock. Если его держит работающий экземпляр, тот по запросу
+// передаёт дела через сокет и выходит, а блокировка переходит к нам.
+// false — pid-файл не заблокировать по иной причине (EACCES, EROFS...).
+bool Daemon::take_over(Handover& h) {
+    auto failed = [this]() {
+        log_msg(LOG_ERR, "cannot lock pid file %s: %m", pid_path.c_str());
+        return false;
+    };
+    for (int round = 0; ; ++round) {
+        if ((pid_fd = lock_pid_file(pid_path, round >= 5)) >= 0) {
+            if (round == 0)
+                ensure_singleton(pid_path);
+            return true;
+        }
+        if (errno != EWOULDBLOCK)
+            return failed();
+        pid_t old = request_handover(h);
+        // прежний выходит сразу после передачи; ждём блокировку до 10 с
+        for (int i = 0; i < 1000; ++i) {
+            if ((pid_fd = lock_pid_file(pid_path, false)) >= 0)
+                return true;
+            if (errno != EWOULDBLOCK)
+                return failed();
+            if (old > 1 && kill(old, 0) != 0 && errno == ESRCH)
+                break; // вышел, а файл уже держит кто-то другой — просим и его
+            usleep(10000);
+        }
+        if (old > 1 && kill(old, 0) == 0) {
+            log_msg(LOG_WARNING, "pid %d did not release %s in time; killing", old, pid_path.c_str());
+            kill(old, SIGKILL);
+        }
+    }
+}
+
+// Возвращает pid прежнего экземпляра; 0 — неизвестен.
+pid_t Daemon::request_handover(Handover& h) {
+    handover_close(h);
+    pid_t old = 0;
+    int sock = -1;
+    // прежний экземпляр может ещё запускаться и не слушать сокет
+    for (int i = 0; i < 20 && (sock = handover_connect(pid_path + ".sock", old)) < 0; ++i)
+        usleep(100000);
+    if (sock < 0) {
+        old = read_pid(pid_path);
+        log_msg(LOG_WARNING, "no handover socket; sending SIGTERM to pid %d", old);
+        if (old > 1)
+            kill(old, SIGTERM);
+        return old;
+    }
+    log_msg(LOG_INFO, "found running instance pid=%d, taking over", old);
+    kill(old, SIGUSR1);
+    // он доделывает начатые переносы — ждём дольше, чем длится перенос одного файла
+    if (!handover_receive(sock, h, 60000))
+        handover_close(h);
+    close(sock);
+    return old;
+}
+
+// То, что отдал прежний экземпляр: дескрипторы каталогов правил по ключу правила,
+// inotify и период. Не подошедшее (правило убрано из конфига) закрывается.
+void Daemon::adopt(Handover& h) {
+    if (h.tick_sec > 0)
+        tick_sec = std::max(h.tick_sec, min_interval_sec); // serve() приводит к периоду каждой группы
+    if (h.inotify >= 0 && !supervisor) {
+        watcher.adopt(h.inotify);
+        h.inotify = -1;
+    }
+    size_t taken = 0;
+    for (Rule& r : rules) {
+        if (!r.state)
+            continue;
+        const uint64_t key = xxh64(r.key().data(), r.key().size());
+        for (HandoverDirs& d : h.dirs) {
+            if (d.rule_key != key || (d.from < 0 && d.to < 0))
+                continue;
+            if (d.from >= 0)
+                r.state->from.adopt(d.from);
+            if (d.to >= 0)
+                r.state->dest.adopt_fd(d.to);
+            d.from = d.to = -1;
+            ++taken;
+            break;
+        }
+    }
+    if (taken || watcher.active())
+        log_msg(LOG_INFO, "handover: took directories of %zu rule(s)%s", taken, watcher.active() ? " and inotify" : "");
+    handover_close(h);
+}
+
+// Проход уже остановлен, переносы доделаны (блочные — приостановлены с отметкой
+// в журнале), снимок сохранён: остаётся отдать дескрипторы.
+void Daemon::hand_over() {
+    if (handover_fd < 0)
+        return;
+    Handover h;
+    h.inotify = watcher.active() ? watcher.fd() : -1;
+    for (const SourceGroup& g : sources)
+        h.tick_sec = h.tick_sec ? std::min(h.tick_sec, g.tick) : g.tick;
+    for (Rule& r : rules) {
+        if (!r.state)
+            continue;
+        HandoverDirs d;
+        d.rule_key = xxh64(r.key().data(), r.key().size());
+        d.from = r.state->from.get();
+        d.to = r.state->dest.fd();
+        h.dirs.push_back(d);
+    }
+    handed_over = handover_send(handover_fd, h, 5000);
+}
+
+// Рабочий цикл: в однопроцессном режиме — самого демона, иначе — обработчика
+// со своей долей источников.
+void Daemon::serve() {
+    resume_state();
+    update_watcher();
+    pool.start(workers, device_workers);
+    // период от прежнего экземпляра — стартовый для всех групп
+    for (SourceGroup& g : sources)
+        g.tick = tick_sec > 0 ? std::clamp(tick_sec, std::min(min_interval_sec, group_interval(g)), group_interval(g)) : 0;
+    rng.seed(static_cast<uint64_t>(getpid()) ^ static_cast<uint64_t>(monotonic_ms()));
+    if (shard < 0)
+        log_msg(LOG_INFO, "started; config=%s pidfile=%s interval=%d watch=%s workers=%d", config_path.c_str(), pid_path.c_str(), interval_sec, watcher.active() ? "on" : "off", workers);
+    else
+        log_msg(LOG_INFO, "worker %d/%d started; sources=%zu watch=%s workers=%d", shard, processes, sources.size(), watcher.active() ? "on" : "off", workers);
+
+    // Первый проход — сразу. Пока идёт проход, реактор принимает сигналы:
+    // SIGTERM останавливает его между файлами, а не после всего тика.
+    sweep_due = true;
+    if (!open_reactor())
+        stop = true;
+    while (!stop || offload.busy()) {
+        if (!offload.busy())
+            dispatch();
+        if (stop && !offload.busy())
+            break;
+        reactor.run_once(-1);
+    }
+    close_reactor();
 
-    write_pid(pid_path);
-    syslog(LOG_INFO, "started; config=%s pidfile=%s interval=%d", config_path.c_str(), pid_path.c_str(), interval_sec);
+    pool.stop();
+    // при передаче дел inotify уходит новому экземпляру вместе с накопленными событиями
+    if (!handover)
+        watcher.close();
+    save_state();
+}
 
+// Мастер не трогает файлы: держит pid-файл, конфиг и обработчиков. Упавший
+// обработчик перезапускается; падающий сразу после старта — с растущей паузой.
+void Daemon::supervise() {
+    log_msg(LOG_INFO, "started; config=%s pidfile=%s interval=%d processes=%d", config_path.c_str(), pid_path.c_str(), interval_sec, processes);
+    children.assign(static_cast<size_t>(processes), Worker{});
+    // SIGCHLD будит реактор, секундный таймер — для отложенных перезапусков
+    if (!open_reactor())
+        stop = true;
     while (!stop) {
         if (reload) {
-            reload = 0;
-            rules = load_config(config_path);
-            int ni = 0;
-            if (try_load_interval(config_path, ni)) {
-                interval_sec = ni;
-                syslog(LOG_INFO, "reloaded config; interval=%d", interval_sec);
+            reload = false;
+            reload_config();
+            // Обработчики перечитывают конфиг сами и пересчитывают свою долю:
+            // при консистентном хешировании переезжает лишь малая часть источников.
+            if (children.size() < static_cast<size_t>(processes))
+                children.resize(static_cast<size_t>(processes));
+            for (size_t k = 0; k < children.size(); ++k)
+                if (children[k].pid > 0)
+                    kill(children[k].pid, k < static_cast<size_t>(processes) ? SIGHUP : SIGTERM);
+        }
+        reap_workers();
+        time_t now = monotonic_sec();
+        for (size_t k = 0; k < children.size() && k < static_cast<size_t>(processes); ++k)
+            if (children[k].pid == 0 && now >= children[k].restart_at)
+                spawn_worker(k);
+        if (!stop && !reload)
+            reactor.run_once(-1);
+    }
+    close_reactor();
+    stop_workers();
+}
+
+void Daemon::spawn_worker(size_t k) {
+    pid_t master = getpid();
+    pid_t pid = fork();
+    if (pid < 0) {
+        log_msg(LOG_ERR, "fork worker %zu: %m", k);
+        children[k].restart_at = monotonic_sec() + 1;
+        return;
+    }
+    if (pid == 0) {
+        // мастер мог умереть ещё до prctl — тогда сигнала уже не будет
+        if (prctl(PR_SET_PDEATHSIG, SIGTERM) != 0 || getppid() != master)
+            _exit(0);
+        run_worker(k);
+    }
+    children[k].pid = pid;
+    children[k].started = monotonic_sec();
+}
+
+void Daemon::run_worker(size_t k) {
+    log_after_fork();
+    signal(SIGUSR1, SIG_IGN);
+    // epoll, signalfd и таймер мастера — не свои: у обработчика будут собственные
+    offload.after_fork();
+    reactor.after_fork();
+    close_reactor();
+    // блокировка pid-файла — у мастера: после его смерти она не должна висеть на обработчиках
+    if (pid_fd >= 0)
+        close(pid_fd);
+    if (handover_fd >= 0)
+        close(handover_fd);
+    pid_fd = handover_fd = -1;
+    // потоки управляющего сокета мастера остались в мастере, ctl_mu мог быть захвачен
+    control.after_fork();
+    new (&ctl_mu) std::mutex();
+    new (&ctl_cv) std::condition_variable();
+    ctl = ControlQueue{};
+    if (wake_fd >= 0)
+        close(wake_fd);
+    wake_fd = -1;
+    supervisor = false;
+    shard = static_cast<int>(k);
+    children.clear();
+    drop_foreign(sources);
+    start_control();
+    serve();
+    control.stop();
+    log_msg(LOG_INFO, "worker %d stopped", shard);
+    log_stop();
+    // снимок и метрики принадлежат мастеру — просто уходим, не трогая их
+    _exit(0);
+}
+
+void Daemon::reap_workers() {
+    int status = 0;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (size_t k = 0; k < children.size(); ++k) {
+            Worker& w = children[k];
+            if (w.pid != pid)
+                continue;
+            w.pid = 0;
+            // журнал общий: недоделанное умершим разбираем сразу, а не при следующем старте
+            if (size_t n = state_recover(pid))
+                log_msg(LOG_NOTICE, "state: recovered %zu cross-device move(s) of worker %zu (pid %d)", n, k, pid);
+            if (k >= static_cast<size_t>(processes) || stop)
+                break; // убран при перечитывании или демон останавливается
+            time_t now = monotonic_sec();
+            w.failures = now - w.started < 10 ? w.failures + 1 : 0;
+            int delay = std::min(60, 1 << std::min(w.failures, 6));
+            w.restart_at = now + delay;
+            if (WIFSIGNALED(status))
+                log_msg(LOG_WARNING, "worker %zu (pid %d) killed by signal %d; restart in %d s", k, pid, WTERMSIG(status), delay);
+            else
+                log_msg(LOG_WARNING, "worker %zu (pid %d) exited with %d; restart in %d s", k, pid, WEXITSTATUS(status), delay);
+            break;
+        }
+    }
+    while (!children.empty() && children.back().pid == 0 && children.size() > static_cast<size_t>(processes))
+        children.pop_back();
+}
+
+// SIGTERM всем и ожидание; кто не успел (например, висит в D-состоянии на
+// мёртвом устройстве), получает SIGKILL — недоделанное разберёт журнал копирований.
+void Daemon::stop_workers() {
+    for (const Worker& w : children)
+        if (w.pid > 0)
+            kill(w.pid, SIGTERM);
+    time_t deadline = monotonic_sec() + 5;
+    for (;;) {
+        int status = 0;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+            for (Worker& w : children)
+                if (w.pid == pid)
+                    w.pid = 0;
+        bool alive = std::any_of(children.begin(), children.end(), [](const Worker& w) { return w.pid > 0; });
+        if (!alive)
+            break;
+        if (monotonic_sec() >= deadline) {
+            for (const Worker& w : children)
+                if (w.pid > 0) {
+                    log_msg(LOG_WARNING, "worker pid %d did not stop in time; killing", w.pid);
+                    kill(w.pid, SIGKILL);
+                }
+            break;
+        }
+        usleep(100000);
+    }
+    children.clear();
+}
+
+// Блокируются во всех потоках процесса (и наследуются обработчиками); читает
+// их signalfd реактора.
+static sigset_t daemon_signals() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGCHLD);
+    return set;
+}
+
+void Daemon::install_signals() {
+    sigset_t set = daemon_signals();
+    block_signals(set);
+}
+
+void Daemon::on_signals() {
+    while (int sig = read_signal(signal_fd)) {
+        switch (sig) {
+        case SIGHUP:
+            reload = true;
+            break;
+        case SIGUSR1:
+            handover = true;
+            [[fallthrough]];
+        case SIGTERM:
+            if (!stop && offload.busy())
+                log_msg(LOG_INFO, "%s: stopping after the current file(s)", sig == SIGTERM ? "SIGTERM" : "handover");
+            stop = true;
+            break;
+        default: // SIGCHLD: мастер разбирает завершившихся на следующем витке
+            break;
+        }
+    }
+}
+
+// Источники событий реактора. Обработчики только ставят флаги — решает, что
+// запускать, dispatch() между проходами.
+bool Daemon::open_reactor() {
+    sigset_t set = daemon_signals();
+    if (shard >= 0)
+        sigdelset(&set, SIGUSR1); // передача дел — дело мастера
+    if (!supervisor)
+        sigdelset(&set, SIGCHLD);
+    signal_fd = open_signalfd(set);
+    timer_fd = open_timer();
+    if (!reactor.open() || signal_fd < 0 || timer_fd < 0)
+        return false;
+    reactor.add(signal_fd, EPOLLIN, [this](uint32_t) { on_signals(); });
+    reactor.add(timer_fd, EPOLLIN, [this](uint32_t) { on_timer(); });
+    if (supervisor) {
+        arm_timer(timer_fd, 1000, 1000);
+        return true;
+    }
+    if (!offload.start())
+        return false;
+    reactor.add(offload.fd(), EPOLLIN, [this](uint32_t) { offload.complete(); });
+    if (wake_fd >= 0)
+        reactor.add(wake_fd, EPOLLIN, [this](uint32_t) {
+            uint64_t v;
+            if (read(wake_fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+                log_msg(LOG_WARNING, "control: wake read: %m");
+        });
+    register_watcher();
+    return true;
+}
+
+void Daemon::close_reactor() {
+    offload.stop();
+    reactor.close();
+    watched_fd = -1;
+    if (signal_fd >= 0)
+        close(signal_fd);
+    if (timer_fd >= 0)
+        close(timer_fd);
+    signal_fd = timer_fd = -1;
+}
+
+void Daemon::register_watcher() {
+    if (watched_fd >= 0)
+        reactor.remove(watched_fd);
+    watched_fd = watcher.fd();
+    if (watched_fd >= 0)
+        reactor.add(watched_fd, EPOLLIN, [this](uint32_t) { events_pending = true; });
+}
+
+// Пока идёт задача, inotify не слушаем (epoll по уровню крутился бы впустую):
+// события копятся в очереди ядра и разбираются после.
+void Daemon::watch_events(bool on) {
+    if (watched_fd >= 0)
+        reactor.modify(watched_fd, on ? EPOLLIN : 0);
+}
+
+void Daemon::on_timer() {
+    if (!read_timer(timer_fd))
+        return;
+    if (auto_reload && shard < 0 && config_changed())
+        reload = true;
+    // сроки групп dispatch() забирает сам
+}
+
+// Свой период группы: самый короткий из периодов её правил — каталог читается
+// один раз на всех.
+int Daemon::group_interval(const SourceGroup& g) const {
+    int iv = 0;
+    for (const Rule* r : g.rules) {
+        int v = r->interval ? r->interval : interval_sec;
+        iv = iv ? std::min(iv, v) : v;
+    }
+    return iv ? iv : interval_sec;
+}
+
+// Пока у группы хвост сверх бюджета — проходы с min_interval, на холостых
+// период удваивается обратно до её interval.
+void Daemon::adapt_tick(SourceGroup& g) {
+    const int iv = group_interval(g), prev = g.tick ? g.tick : iv;
+    if (g.backlog)
+        g.tick = std::min(min_interval_sec, iv);
+    else if (g.moved == 0)
+        g.tick = std::min(iv, prev * 2);
+    else
+        g.tick = std::min(iv, prev);
+    if (g.tick != prev)
+        log_msg(LOG_INFO, "%s: tick %d -> %d s%s", g.from.c_str(), prev, g.tick, g.backlog ? " (backlog)" : "");
+}
+
+// Следующий срок группы: fixed-delay — через tick после конца прохода, fixed-rate —
+// через tick после прошлого срока. Первый срок разносится по фазе (хеш каталога),
+// чтобы группы с одним периодом не ходили на диск одновременно; jitter — случайная
+// добавка сверху. Окна: все правила закрыты — ждём открытия ближайшего, часть
+// закрыта — просыпаемся и к её открытию. Вызывается под ctl_mu.
+void Daemon::reschedule(size_t i, int64_t now_ms) {
+    SourceGroup& g = sources[i];
+    if (!g.tick)
+        g.tick = group_interval(g);
+    const int64_t tick_ms = int64_t(g.tick) * 1000;
+    int64_t due;
+    if (!g.due_ms) {
+        due = now_ms + tick_ms / 2 + int64_t(xxh64(g.from.c_str(), g.from.native().size()) % uint64_t(tick_ms / 2 + 1));
+    } else if (fixed_rate) {
+        due = g.due_ms + tick_ms;
+        if (due <= now_ms) {
+            log_msg(LOG_DEBUG, "%s: pass longer than %d s, ticks merged", g.from.c_str(), g.tick);
+            due = now_ms;
+        }
+    } else {
+        due = now_ms + tick_ms;
+    }
+
+    const time_t wall = time(nullptr);
+    int64_t open_ms = -1;
+    bool any_open = false;
+    for (const Rule* r : g.rules) {
+        if (r->window.contains(wall)) {
+            any_open = true;
+        } else if (time_t t = r->window.next_open(wall)) {
+            int64_t at = now_ms + int64_t(t - wall) * 1000;
+            open_ms = open_ms < 0 ? at : std::min(open_ms, at);
+        }
+    }
+    if (open_ms >= 0)
+        due = any_open ? std::min(due, open_ms) : open_ms;
+    g.due_ms = due;
+
+    int jitter = 0;
+    for (const Rule* r : g.rules)
+        jitter = std::max(jitter, r->jitter);
+    if (jitter > 0)
+        due += int64_t(rng() % uint64_t(int64_t(jitter) * 1000 + 1));
+    scheduler.set(i, due);
+}
+
+// Таймер взводится однократно на ближайший срок.
+void Daemon::arm_next() {
+    const int64_t due = scheduler.next();
+    if (due < 0) {
+        arm_timer(timer_fd, 0, 0);
+        return;
+    }
+    arm_timer(timer_fd, std::max<int64_t>(1, due - monotonic_ms()), 0);
+}
+
+// Все группы заново: после смены interval через сокет.
+void Daemon::reschedule_all() {
+    std::lock_guard<std::mutex> lk(ctl_mu);
+    scheduler.clear();
+    const int64_t now = monotonic_ms();
+    for (size_t i = 0; i < sources.size(); ++i) {
+        sources[i].tick = 0;
+        sources[i].due_ms = 0;
+        reschedule(i, now);
+    }
+}
+
+// Между задачами: перечитать конфиг, применить команды сокета и запустить
+// следующую работу — полный проход, группы, чей срок подошёл (вместе с
+// запрошенными через сокет), или разбор событий.
+void Daemon::dispatch() {
+    if (reload) {
+        reload = false;
+        reload_config();
+        register_watcher();
+        scheduler.clear(); // индексы групп сменились; сроки назначит полный проход
+        sweep_due = true;
+        if (stop)
+            return;
+    }
+    if (apply_control())
+        reschedule_all();
+
+    ScanRequest scan = take_scan();
+    if (sweep_due || scan.all) {
+        sweep_due = false;
+        start_pass(std::move(scan), std::vector<char>(sources.size(), 1));
+        return;
+    }
+    std::vector<size_t> due;
+    scheduler.take_due(monotonic_ms(), due);
+    if (scan.ticket || !due.empty()) {
+        std::vector<char> only(sources.size());
+        for (size_t i : due)
+            if (i < only.size())
+                only[i] = 1;
+        for (size_t i = 0; i < sources.size(); ++i)
+            if (std::find(scan.from.begin(), scan.from.end(), sources[i].from) != scan.from.end())
+                only[i] = 1;
+        start_pass(std::move(scan), std::move(only));
+    } else if (events_pending) {
+        start_events();
+    } else {
+        arm_next();
+    }
+}
+
+// Проход по группам из маски only; после него им назначаются новые сроки.
+void Daemon::start_pass(ScanRequest scan, std::vector<char> only) {
+    auto mask = std::make_shared<std::vector<char>>(std::move(only));
+    auto res = std::make_shared<SourceResult>();
+    auto req = std::make_shared<ScanRequest>(std::move(scan));
+    watch_events(false);
+    offload.post([this, mask, res] { *res = run_pass(mask.get()); },
+                 [this, mask, res, req] {
+                     {
+                         std::lock_guard<std::mutex> lk(ctl_mu);
+                         const int64_t now = monotonic_ms();
+                         for (size_t i = 0; i < sources.size() && i < mask->size(); ++i)
+                             if ((*mask)[i]) {
+                                 adapt_tick(sources[i]);
+                                 reschedule(i, now);
+                             }
+                     }
+                     count_tick();
+                     save_state();
+                     finish_scan(*req, *res);
+                     watch_events(true);
+                     arm_next();
+                 });
+}
+
+void Daemon::start_events() {
+    events_pending = false;
+    auto evs = std::make_shared<std::vector<WatchEvent>>();
+    if (!watcher.drain(*evs)) {
+        // очередь ядра переполнилась — события неполные, нужен полный проход
+        start_pass(ScanRequest{}, std::vector<char>(sources.size(), 1));
+        return;
+    }
+    if (evs->empty())
+        return;
+    watch_events(false);
+    offload.post([this, evs] { process_events(*evs); }, [this] { watch_events(true); });
+}
+
+time_t Daemon::monotonic_sec() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+int64_t Daemon::monotonic_ms() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+void Daemon::update_watcher() {
+    if (!watch_enabled) {
+        watcher.close();
+        return;
+    }
+    if (!watcher.open()) {
+        log_msg(LOG_WARNING, "event mode unavailable; falling back to interval scan");
+        return;
+    }
+    watcher.rebuild(sources);
+}
+
+void Daemon::process_events(std::vector<WatchEvent>& evs) {
+
+    // группируем по источнику и убираем повторы одного имени
+    std::sort(evs.begin(), evs.end(), [](const WatchEvent& a, const WatchEvent& b) {
+        return a.source != b.source ? a.source < b.source : a.name < b.name;
+    });
+    std::vector<std::string> names;
+    for (size_t i = 0; i < evs.size(); ) {
+        size_t si = evs[i].source;
+        names.clear();
+        for (; i < evs.size() && evs[i].source == si; ++i) {
+            if (names.empty() || names.back() != evs[i].name)
+                names.push_back(std::move(evs[i].name));
+        }
+        if (si < sources.size())
+            process_entries(sources[si], names, worker_opt);
+    }
+}
+
+// Один разбор файла на загрузку. Правила с тем же ключом, что и раньше,
+// переносят своё состояние; курсоры источников переходят в новые группы.
+size_t Daemon::apply_config(Config&& c) {
+    interval_sec = c.interval;
+    min_interval_sec = std::min(c.min_interval, interval_sec);
+    watch_enabled = c.watch;
+    auto_reload = c.auto_reload;
+    fixed_rate = c.fixed_rate;
+    workers = c.workers;
+    device_workers = c.device_workers;
+    if (supervisor || shard >= 0)
+        processes = c.processes;
+    else if (c.processes != processes)
+        log_msg(LOG_WARNING, "processes=%d takes effect after restart", c.processes);
+    metrics_path = c.metrics;
+    log_sink = c.log;
+
+    if (c.backend == "uring") {
+        worker_opt.backend = MoveBackend::Uring;
+    } else {
+        if (c.backend != "sync")
+            log_msg(LOG_WARNING, "unknown backend '%s'; using sync", c.backend.c_str());
+        worker_opt.backend = MoveBackend::Sync;
+    }
+    TransferOptions topt;
+    topt.chunked_min = c.chunked_min;
+    topt.threads = static_cast<unsigned>(c.copy_threads);
+    topt.direct = c.direct_io;
+    topt.stop = &stop;
+    transfer_set_options(topt);
+    commit_set_options(c.commit);
+    // общий лимит делится между обработчиками поровну
+    const uint64_t share = static_cast<uint64_t>(std::max(1, processes));
+    throttle_set_global(c.rate.bytes ? std::max<uint64_t>(1, c.rate.bytes / share) : 0,
+                        c.rate.ops ? std::max<uint64_t>(1, c.rate.ops / share) : 0);
+    tree_workers = c.tree_workers;
+    size_tree_pool();
+
+    size_t kept = prepare_rules(c.rules, rules);
+    std::vector<SourceGroup> groups = group_by_source(c.rules, sources);
+    drop_foreign(groups);
+    rules = std::move(c.rules); // буфер переезжает целиком — указатели групп остаются верными
+    sources = std::move(groups);
+    conf_mtime = config_mtime();
+    return kept;
+}
+
+void Daemon::reload_config() {
+    Config c;
+    if (!parse_config(config_path, c)) {
+        log_msg(LOG_WARNING, "config unreadable on reload; keep current");
+        return;
+    }
+    if (c.interval == 0) {
+        log_msg(LOG_WARNING, "no valid 'interval' on reload; keep %d", interval_sec);
+        c.interval = interval_sec;
+    }
+    const int old_workers = workers, old_device_workers = device_workers;
+    size_t kept;
+    {
+        std::lock_guard<std::mutex> lk(ctl_mu);
+        kept = apply_config(std::move(c));
+    }
+    log_reopen(log_sink);
+    assign_slots();
+    if (shard >= processes) {
+        stop = true; // лишний после уменьшения processes; мастер его не перезапустит
+        return;
+    }
+    if (supervisor) {
+        log_msg(LOG_INFO, "reloaded config; interval=%d rules=%zu (kept %zu) processes=%d", interval_sec, rules.size(), kept, processes);
+        return;
+    }
+    update_watcher();
+    if (workers != old_workers || device_workers != old_device_workers) {
+        pool.start(workers, device_workers);
+        log_msg(LOG_INFO, "workers=%d device_workers=%d", workers, device_workers);
+    }
+    if (shard >= 0)
+        log_msg(LOG_INFO, "worker %d reloaded config; sources=%zu", shard, sources.size());
+    else
+        log_msg(LOG_INFO, "reloaded config; interval=%d rules=%zu (kept %zu)", interval_sec, rules.size(), kept);
+}
+
+// Обработчик оставляет себе только источники своей доли.
+void Daemon::drop_foreign(std::vector<SourceGroup>& groups) const {
+    if (shard < 0)
+        return;
+    groups.erase(std::remove_if(groups.begin(), groups.end(), [&](const SourceGroup& g) {
+        return shard_of(g.from, static_cast<size_t>(processes)) != static_cast<size_t>(shard);
+    }), groups.end());
+}
+
+int64_t Daemon::config_mtime() const {
+    struct stat st{};
+    if (stat(config_path.c_str(), &st) != 0)
+        return 0;
+    return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+bool Daemon::config_changed() const {
+    int64_t m = config_mtime();
+    return m != 0 && m != conf_mtime;
+}
+
+void Daemon::open_metrics() {
+    std::string path = metrics_path.empty() ? "/dev/shm/" + log_tag + ".metrics" : metrics_path;
+    if (to_lower(path) == "off")
+        return;
+    if (metrics_open(path))
+        log_msg(LOG_INFO, "metrics at %s", path.c_str());
+}
+
+// Перенесённые при перечитывании правила сохраняют слот и накопленные счётчики;
+// новые занимают свободные, освободившиеся слоты остаются без подписи.
+// Обработчики вычисляют те же номера, что и мастер (вход тот же), но блок
+// метрик подписывает только мастер.
+void Daemon::assign_slots() {
+    const bool publish = shard < 0;
+    std::vector<bool> used(kMetricsRules, false);
+    for (const Rule& r : rules)
+        if (r.slot >= 0)
+            used[static_cast<size_t>(r.slot)] = true;
+    if (publish)
+        metrics_begin_update();
+    for (size_t i = 0; i < slots_in_use && publish; ++i)
+        if (!used[i])
+            metrics_assign(static_cast<int>(i), "", "", "");
+    size_t next = 0;
+    for (Rule& r : rules) {
+        if (r.slot >= 0)
+            continue;
+        while (next < kMetricsRules && used[next])
+            ++next;
+        if (next == kMetricsRules)
+            break;
+        r.slot = static_cast<int>(next);
+        used[next] = true;
+        if (publish)
+            metrics_assign(r.slot, r.from.string(), r.to.string(), r.spec);
+    }
+    slots_in_use = 0;
+    for (size_t i = 0; i < kMetricsRules; ++i)
+        if (used[i])
+            slots_in_use = i + 1;
+    if (publish)
+        metrics_end_update(slots_in_use);
+}
+
+// Снимок рядом с pid-файлом: прошлый запуск мог оставить недоделанные копирования
+// и всё, что нужно, чтобы продолжить с того же места, а не с холодного старта.
+// Журнал и счётчики разбирает тот, кто держит pid-файл; курсоры и подсказки
+// имён — каждый, кто обслуживает источники (resume_state).
+void Daemon::restore_state() {
+    if (!state_open(pid_path + ".state"))
+        return;
+    if (size_t n = state_recover())
+        log_msg(LOG_NOTICE, "state: recovered %zu interrupted cross-device move(s)", n);
+    size_t restored = 0;
+    for (Rule& r : rules) {
+        const RuleRecord* rec = state_find(xxh64(r.key().data(), r.key().size()));
+        if (!rec)
+            continue;
+        ++restored;
+        if (RuleMetrics* m = metrics_rule(r.slot)) {
+            bump(m->moved, rec->moved);
+            bump(m->renamed, rec->renamed);
+            bump(m->copied, rec->copied);
+            bump(m->bytes, rec->bytes);
+            bump(m->errors, rec->errors);
+            bump(m->deduped, rec->deduped);
+            bump(m->dedup_bytes, rec->dedup_bytes);
+        }
+    }
+    if (restored)
+        log_msg(LOG_INFO, "state: resumed %zu rule(s) from %s.state", restored, pid_path.c_str());
+}
+
+void Daemon::resume_state() {
+    for (SourceGroup& g : sources)
+        for (const Rule* r : g.rules) {
+            const RuleRecord* rec = state_find(xxh64(r->key().data(), r->key().size()));
+            if (!rec)
+                continue;
+            for (uint32_t i = 0; i < rec->hint_count && i < kStateHints; ++i)
+                r->state->dest.seed_hint(rec->hints[i].key, static_cast<unsigned long>(rec->hints[i].max));
+            if (r == g.rules.front()) {
+                g.cursor = rec->cursor;
+                g.backlog = rec->backlog != 0;
             }
-            else {
-                syslog(LOG_WARNING, "no valid 'interval' on reload; keep %d", interval_sec);
+        }
+}
+
+// Пишутся только правила обслуживаемых источников: у обработчика — его доли,
+// записи остальных правил ведут их владельцы. Номер записи — номер правила в конфиге.
+void Daemon::save_state() {
+    for (const SourceGroup& g : sources)
+        for (const Rule* rp : g.rules) {
+            size_t i = static_cast<size_t>(rp - rules.data());
+            if (i >= kStateRules)
+                continue;
+            const Rule& r = *rp;
+            RuleRecord rec{};
+            rec.key = xxh64(r.key().data(), r.key().size());
+            if (rp == g.rules.front()) {
+                rec.cursor = g.cursor;
+                rec.backlog = g.backlog;
+            }
+            if (const RuleMetrics* m = metrics_rule(r.slot)) {
+                rec.moved = m->moved.load();
+                rec.renamed = m->renamed.load();
+                rec.copied = m->copied.load();
+                rec.bytes = m->bytes.load();
+                rec.errors = m->errors.load();
+                rec.deduped = m->deduped.load();
+                rec.dedup_bytes = m->dedup_bytes.load();
             }
+            // прямое отображение по ключу: при нехватке места остаётся последняя подсказка
+            r.state->dest.for_each_suffix([&](uint64_t key, unsigned long max) {
+                SuffixHint& h = rec.hints[key % kStateHints];
+                if (h.max == 0)
+                    ++rec.hint_count;
+                h = SuffixHint{key, max};
+            });
+            // компактно в начало, чтобы hint_count описывал префикс
+            std::stable_partition(std::begin(rec.hints), std::end(rec.hints), [](const SuffixHint& h) { return h.max != 0; });
+            state_store(i, rec);
         }
-        for (const auto& r : rules) process_rule(r);
-        sleep(interval_sec);
+    state_end_save(std::min(rules.size(), kStateRules));
+}
+
+void Daemon::count_tick() {
+    if (MetricsBlock* m = metrics_block())
+        bump(m->ticks);
+}
+
+// Сокет управления: <pid>.ctl у единственного процесса или мастера, <pid>.ctl.<k>
+// у обработчика k (мастер пересылает команды им).
+void Daemon::start_control() {
+    std::string path = pid_path + ".ctl";
+    if (shard >= 0)
+        path += "." + std::to_string(shard);
+    if (!supervisor && wake_fd < 0) {
+        wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (wake_fd < 0)
+            log_msg(LOG_WARNING, "control: eventfd: %m");
     }
+    control.start(path, [this](const std::string& cmd, std::string& reply) { on_control(cmd, reply); });
+}
 
-    syslog(LOG_INFO, "stopped");
-    unlink(pid_path.c_str());
-    closelog();
+void Daemon::wake() {
+    uint64_t one = 1;
+    if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        log_msg(LOG_WARNING, "control: wake: %m");
 }
 
-void Daemon::on_sighup(int)  { instance().reload = 1; }
-void Daemon::on_sigterm(int) { instance().stop   = 1; }
+static const char* kControlHelp =
+    "status                  passes, rules and copies in flight\n"
+    "scan [all|<rule>] [wait] move now; wait - reply when done\n"
+    "pause <rule>            leave the rule's files in place\n"
+    "resume <rule>\n"
+    "interval <sec>          until the next config reload\n"
+    "workers <n> [<per_dev>] until the next config reload\n"
+    "<rule> is a number from status or a from directory (all its rules)\n";
 
-void Daemon::install_signals() {
-    struct sigaction sa{};
-    sa.sa_handler = &Daemon::on_sighup;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    sigaction(SIGHUP, &sa, nullptr);
-
-    sa.sa_handler = &Daemon::on_sigterm;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    sigaction(SIGTERM, &sa, nullptr);
-}
\ No newline at end of file
+static std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t"), e = s.find_last_not_of(" \t");
+    return b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+}
+
+void Daemon::on_control(const std::string& line, std::string& reply) {
+    const std::string cmd = trim(line);
+    const size_t sp = cmd.find_first_of(" \t");
+    const std::string verb = cmd.substr(0, sp);
+    const std::string arg = sp == std::string::npos ? std::string() : trim(cmd.substr(sp));
+
+    if (verb == "help") {
+        reply = kControlHelp;
+        reply += "ok\n";
+        return;
+    }
+    if (verb == "status") {
+        control_status(reply);
+        return;
+    }
+    if (verb == "scan") {
+        if (supervisor)
+            forward_control(cmd, reply);
+        else
+            control_scan(arg, reply);
+        return;
+    }
+    if (verb == "pause" || verb == "resume") {
+        std::vector<Rule*> sel;
+        {
+            std::lock_guard<std::mutex> lk(ctl_mu);
+            if (!select_rules(arg, sel)) {
+                reply = "error no such rule: " + arg + "\n";
+                return;
+            }
+            // у мастера — для обработчиков, которые он запустит потом
+            for (Rule* r : sel)
+                r->state->paused.store(verb == "pause");
+        }
+        if (supervisor) {
+            forward_control(cmd, reply);
+            return;
+        }
+        log_msg(LOG_INFO, "control: %s %zu rule(s) of %s", verb == "pause" ? "paused" : "resumed", sel.size(), arg.c_str());
+        reply = "ok " + std::to_string(sel.size()) + " rule(s)\n";
+        return;
+    }
+    if (verb == "interval" || verb == "workers") {
+        int a = 0, b = 0;
+        if (std::sscanf(arg.c_str(), "%d %d", &a, &b) < 1 || a <= 0 || b < 0) {
+            reply = "error usage: " + std::string(verb == "interval" ? "interval <sec>" : "workers <n> [<per_dev>]") + "\n";
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lk(ctl_mu);
+            if (supervisor) {
+                // мастер сам не обходит каталоги — запоминает для новых обработчиков
+                if (verb == "interval")
+                    interval_sec = a;
+                else {
+                    workers = a;
+                    device_workers = b ? b : device_workers;
+                }
+            } else if (verb == "interval") {
+                ctl.interval = a;
+            } else {
+                ctl.workers = a;
+                ctl.device_workers = b;
+            }
+        }
+        if (supervisor) {
+            forward_control(cmd, reply);
+            return;
+        }
+        wake();
+        reply = "ok\n";
+        return;
+    }
+    reply = "error unknown command '" + verb + "' (try help)\n";
+}
+
+// Номер правила в порядке конфига (как в status) или каталог from — все его правила.
+bool Daemon::select_rules(const std::string& sel, std::vector<Rule*>& out) {
+    out.clear();
+    if (sel.empty())
+        return false;
+    char* end = nullptr;
+    unsigned long idx = std::strtoul(sel.c_str(), &end, 10);
+    if (end && *end == '\0' && std::isdigit(static_cast<unsigned char>(sel[0]))) {
+        if (idx >= rules.size() || !rules[idx].state)
+            return false;
+        out.push_back(&rules[idx]);
+        return true;
+    }
+    const fs::path from = fs::path(sel).lexically_normal();
+    for (Rule& r : rules)
+        if (r.state && (r.from == from || r.from.lexically_normal() == from))
+            out.push_back(&r);
+    return !out.empty();
+}
+
+void Daemon::control_scan(std::string sel, std::string& reply) {
+    bool wait = false;
+    if (sel == "wait" || (sel.size() > 5 && sel.compare(sel.size() - 5, 5, " wait") == 0)) {
+        wait = true;
+        sel = trim(sel.substr(0, sel.size() - 4));
+    }
+    std::unique_lock<std::mutex> lk(ctl_mu);
+    if (sel.empty() || sel == "all") {
+        ctl.scan_all = true;
+    } else {
+        std::vector<Rule*> picked;
+        if (!select_rules(sel, picked)) {
+            reply = "error no such rule: " + sel + "\n";
+            return;
+        }
+        for (const Rule* r : picked)
+            ctl.scan_from.push_back(r->from);
+    }
+    const uint64_t ticket = ++ctl.scan_requested;
+    lk.unlock();
+    wake();
+    if (!wait) {
+        reply = "ok queued\n";
+        return;
+    }
+    lk.lock();
+    while (ctl.scan_done < ticket) {
+        if (stop) {
+            reply = "error stopping\n";
+            return;
+        }
+        ctl_cv.wait_for(lk, std::chrono::milliseconds(200));
+    }
+    reply = "ok moved=" + std::to_string(ctl.scan_moved) + " backlog=" + (ctl.scan_backlog ? "1" : "0") + "\n";
+}
+
+void Daemon::control_status(std::string& reply) {
+    std::vector<std::string> lines;
+    {
+        std::lock_guard<std::mutex> lk(ctl_mu);
+        const time_t now = monotonic_sec();
+        const int64_t now_ms = monotonic_ms();
+        const time_t wall = time(nullptr);
+        char head[256];
+        if (supervisor) {
+            std::snprintf(head, sizeof(head), "master pid=%d processes=%d interval=%d workers=%d device_workers=%d",
+                          int(getpid()), processes, interval_sec, workers, device_workers);
+        } else {
+            char pass[64];
+            int64_t next = -1;
+            for (const SourceGroup& g : sources)
+                if (g.due_ms)
+                    next = next < 0 ? g.due_ms : std::min(next, g.due_ms);
+            if (ctl.pass_running)
+                std::snprintf(pass, sizeof(pass), "running %llds", (long long)(now - ctl.pass_started));
+            else
+                std::snprintf(pass, sizeof(pass), "idle next=%llds", (long long)std::max<int64_t>(0, (next - now_ms) / 1000));
+            std::string who = shard >= 0 ? "worker " + std::to_string(shard) : "pid=" + std::to_string(getpid());
+            std::snprintf(head, sizeof(head), "%s pass %s interval=%d workers=%d device_workers=%d watch=%s scans_pending=%llu",
+                          who.c_str(), pass, interval_sec, workers, device_workers, watcher.active() ? "on" : "off",
+                          (unsigned long long)(ctl.scan_requested - ctl.scan_done));
+        }
+        lines.push_back(head);
+        if (!supervisor)
+            for (const SourceGroup& g : sources)
+                for (const Rule* r : g.rules) {
+                    const char* st = r->state->paused.load() ? " paused" : r->window.contains(wall) ? " active" : " closed";
+                    std::string l = "rule " + std::to_string(r - rules.data()) + " from=" + r->from.string() + " to=" + r->to.string() +
+                                    " filter=" + r->spec + st + " interval=" + std::to_string(r->interval ? r->interval : interval_sec) +
+                                    " tick=" + std::to_string(g.tick) + " next=" +
+                                    std::to_string(std::max<int64_t>(0, (g.due_ms - now_ms) / 1000)) + "s";
+                    if (!r->window.always())
+                        l += " window=" + r->window.text;
+                    for (size_t i = 0; i < r->fanout.size(); ++i)
+                        l += (i ? "," : " fanout=") + r->fanout[i].string();
+                    if (r->state->busy.load())
+                        l += " busy";
+                    if (r->state->backlog.load())
+                        l += " backlog";
+                    lines.push_back(l);
+                }
+    }
+    // журнал копирований общий для всех процессов — его показывает тот, кто держит pid-файл
+    if (shard < 0)
+        for (const CopyView& c : state_copies_in_flight()) {
+            std::string l = "copy " + c.src + " -> " + c.tmp + " size=" + std::to_string(c.size);
+            if (c.chunks)
+                l += " chunks=" + std::to_string(c.done) + "/" + std::to_string(c.chunks);
+            if (c.placed)
+                l += " placed";
+            else if (c.committing)
+                l += " committing";
+            lines.push_back(l);
+        }
+    for (const std::string& l : lines)
+        reply += l + "\n";
+    if (supervisor) {
+        forward_control("status", reply);
+        return;
+    }
+    reply += "ok\n";
+}
+
+// scan wait у обработчика длится весь проход, но не дольше этого: зависший
+// (например, в D-состоянии на мёртвом устройстве) не держит поток мастера вечно.
+static constexpr int kForwardScanMs = 30 * 60 * 1000;
+
+// Мастер: команда уходит всем обработчикам параллельно (scan wait каждого идёт
+// своим чередом), ответы склеиваются; moved= суммируется, ошибка — первая.
+void Daemon::forward_control(const std::string& cmd, std::string& reply) {
+    int n;
+    {
+        std::lock_guard<std::mutex> lk(ctl_mu);
+        n = processes;
+    }
+    const bool waits = cmd.compare(0, 4, "scan") == 0;
+    std::vector<std::string> replies(static_cast<size_t>(n));
+    std::vector<char> reached(static_cast<size_t>(n));
+    std::vector<std::thread> asks;
+    for (int k = 0; k < n; ++k)
+        asks.emplace_back([&, k] {
+            reached[size_t(k)] = control_request(pid_path + ".ctl." + std::to_string(k), cmd, replies[size_t(k)], waits ? kForwardScanMs : 5000);
+        });
+    for (std::thread& t : asks)
+        t.join();
+
+    unsigned long long moved = 0;
+    bool has_moved = false, backlog = false;
+    std::string error;
+    for (int k = 0; k < n; ++k) {
+        const std::string& r = replies[size_t(k)];
+        if (!reached[size_t(k)]) {
+            reply += "worker " + std::to_string(k) + " unavailable\n";
+            continue;
+        }
+        size_t last = r.rfind('\n', r.size() - 2);
+        last = last == std::string::npos ? 0 : last + 1;
+        reply.append(r, 0, last);
+        const std::string fin = r.substr(last, r.size() - last - 1);
+        if (fin.compare(0, 5, "error") == 0) {
+            if (error.empty())
+                error = "error worker " + std::to_string(k) + ":" + fin.substr(5);
+            continue;
+        }
+        if (size_t p = fin.find("moved="); p != std::string::npos) {
+            moved += std::strtoull(fin.c_str() + p + 6, nullptr, 10);
+            has_moved = true;
+        }
+        backlog = backlog || fin.find("backlog=1") != std::string::npos;
+    }
+    if (!error.empty())
+        reply += error + "\n";
+    else if (has_moved)
+        reply += "ok moved=" + std::to_string(moved) + " backlog=" + (backlog ? "1" : "0") + "\n";
+    else
+        reply += "ok\n";
+}
+
+// Главный поток: интервал и потоки, заданные через сокет; true — сменился интервал.
+bool Daemon::apply_control() {
+    std::lock_guard<std::mutex> lk(ctl_mu);
+    bool changed = false;
+    if (ctl.interval > 0) {
+        interval_sec = ctl.interval;
+        min_interval_sec = std::min(min_interval_sec, interval_sec);
+        ctl.interval = 0;
+        changed = true;
+        log_msg(LOG_INFO, "control: interval=%d", interval_sec);
+    }
+    if (ctl.workers > 0) {
+        workers = ctl.workers;
+        if (ctl.device_workers > 0)
+            device_workers = ctl.device_workers;
+        ctl.workers = ctl.device_workers = 0;
+        pool.start(workers, device_workers);
+        size_tree_pool();
+        log_msg(LOG_INFO, "control: workers=%d device_workers=%d", workers, device_workers);
+    }
+    return changed;
+}
+
+// Обход поддерева идёт внутри потока RulePool, и таких обходов может быть workers
+// сразу: без tree_workers ядра делятся между ними, а не достаются каждому целиком.
+void Daemon::size_tree_pool() {
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    worker_opt.tree_workers = tree_workers > 0 ? static_cast<size_t>(tree_workers)
+                                               : std::max(1u, cores / static_cast<unsigned>(std::max(1, workers)));
+}
+
+Daemon::ScanRequest Daemon::take_scan() {
+    std::lock_guard<std::mutex> lk(ctl_mu);
+    ScanRequest s;
+    if (!ctl.scan_all && ctl.scan_from.empty())
+        return s;
+    s.ticket = ctl.scan_requested;
+    s.all = ctl.scan_all;
+    s.from.swap(ctl.scan_from);
+    ctl.scan_all = false;
+    return s;
+}
+
+SourceResult Daemon::run_pass(const std::vector<char>* only) {
+    {
+        std::lock_guard<std::mutex> lk(ctl_mu);
+        ctl.pass_running = true;
+        ctl.pass_started = monotonic_sec();
+    }
+    SourceResult r = pool.run(sources, worker_opt, only);
+    std::lock_guard<std::mutex> lk(ctl_mu);
+    ctl.pass_running = false;
+    return r;
+}
+
+// Проход, прерванный перечитыванием конфига, запрос не закрывает: он вернётся
+// в очередь и будет выполнен уже с новыми правилами.
+void Daemon::finish_scan(ScanRequest& scan, const SourceResult& r) {
+    if (!scan.ticket)
+        return;
+    {
+        std::lock_guard<std::mutex> lk(ctl_mu);
+        if (reload && !stop) {
+            ctl.scan_all = ctl.scan_all || scan.all;
+            ctl.scan_from.insert(ctl.scan_from.end(), scan.from.begin(), scan.from.end());
+            return;
+        }
+        ctl.scan_done = std::max(ctl.scan_done, scan.ticket);
+        ctl.scan_moved = r.moved;
+        ctl.scan_backlog = r.backlog;
+    }
+    ctl_cv.notify_all();
+}
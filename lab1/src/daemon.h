@@ -1,8 +1,19 @@
 #pragma once
 
 #include "config.h"
+#include "control.h"
+#include "handover.h"
+#include "reactor.h"
+#include "rule_pool.h"
+#include "watcher.h"
 
 #include <signal.h>
+#include <sys/types.h>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <mutex>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -19,17 +30,137 @@ private:
     Daemon& operator=(const Daemon&) = delete;
 
     void install_signals();
+    bool take_over(Handover& h);
+    pid_t request_handover(Handover& h);
+    void adopt(Handover& h);
+    void hand_over();
+    void serve();
+    void supervise();
+    void start_control();
+    void on_control(const std::string& cmd, std::string& reply);
+    void control_status(std::string& reply);
+    void control_scan(std::string sel, std::string& reply);
+    bool select_rules(const std::string& sel, std::vector<Rule*>& out);
+    void forward_control(const std::string& cmd, std::string& reply);
+    bool apply_control();
+    void size_tree_pool();
+    void wake();
+    void spawn_worker(size_t k);
+    [[noreturn]] void run_worker(size_t k);
+    void reap_workers();
+    void stop_workers();
+    size_t apply_config(Config&& c);
+    void drop_foreign(std::vector<SourceGroup>& groups) const;
+    void reload_config();
+    int64_t config_mtime() const;
+    bool config_changed() const;
+    void open_metrics();
+    void assign_slots();
+    void restore_state();
+    void resume_state();
+    void save_state();
+    void count_tick();
+    void update_watcher();
+    int group_interval(const SourceGroup& g) const;
+    void adapt_tick(SourceGroup& g);
+    void reschedule(size_t i, int64_t now_ms);
+    void reschedule_all();
+    void arm_next();
+    void process_events(std::vector<WatchEvent>& evs);
+    static time_t monotonic_sec();
+    static int64_t monotonic_ms();
 
-    static void on_sighup(int);
-    static void on_sigterm(int);
+    bool open_reactor();
+    void close_reactor();
+    void register_watcher();
+    void watch_events(bool on);
+    void on_signals();
+    void on_timer();
+    void dispatch();
+
+    // Проход вне очереди, запрошенный через управляющий сокет.
+    struct ScanRequest {
+        uint64_t ticket = 0; // 0 — запросов нет
+        bool all = false;
+        std::vector<fs::path> from;
+    };
+    ScanRequest take_scan();
+    SourceResult run_pass(const std::vector<char>* only);
+    void finish_scan(ScanRequest& scan, const SourceResult& r);
+    void start_pass(ScanRequest scan, std::vector<char> only);
+    void start_events();
+
+    // Процесс-обработчик в многопроцессном режиме.
+    struct Worker {
+        pid_t pid = 0;
+        time_t started = 0;
+        time_t restart_at = 0; // монотонное время; 0 — запускать сразу
+        int failures = 0;      // подряд упавших вскоре после старта
+    };
 
     bool initialized_ = false;
 
     std::string config_path;
     std::string pid_path   = "/tmp/lab1d.pid";
     std::string log_tag    = "lab1d";
+    std::string log_sink   = "syslog";
+    std::string metrics_path;
     std::vector<Rule> rules;
+    std::vector<SourceGroup> sources;
     int interval_sec = 0;
-    volatile sig_atomic_t reload = 0;
-    volatile sig_atomic_t stop   = 0;
+    int min_interval_sec = 1;
+    int tick_sec = 0; // период от прежнего экземпляра: с него начинают группы
+    bool watch_enabled = false;
+    bool auto_reload = false;
+    bool fixed_rate = false;
+    int64_t conf_mtime = 0;
+    size_t slots_in_use = 0;
+    int workers = 1;
+    int device_workers = 1;
+    int tree_workers = 0; // из конфига; 0 — ядра поровну между workers
+    int processes = 1;
+    bool supervisor = false; // мастер: только pid-файл, сигналы, конфиг и обработчики
+    int shard = -1;          // номер обработчика; -1 — обслуживаются все источники
+    std::vector<Worker> children;
+    int pid_fd = -1;      // pid-файл под flock, пока процесс жив
+    int handover_fd = -1; // слушающий сокет <pid>.sock
+    bool handed_over = false;
+
+    // Управляющий сокет <pid>.ctl. Его потоки читают правила и кладут запросы под
+    // ctl_mu; главный поток забирает запросы и меняет rules/sources тоже под ним.
+    struct ControlQueue {
+        bool scan_all = false;
+        std::vector<fs::path> scan_from;
+        uint64_t scan_requested = 0, scan_done = 0;
+        size_t scan_moved = 0; // итог последнего прохода, закрывшего запросы
+        bool scan_backlog = false;
+        int interval = 0;      // 0 — без изменений
+        int workers = 0, device_workers = 0;
+        bool pass_running = false;
+        time_t pass_started = 0;
+    };
+    ControlServer control;
+    std::mutex ctl_mu;
+    std::condition_variable ctl_cv; // проход закончился
+    ControlQueue ctl;
+    int wake_fd = -1; // eventfd: будит главный цикл
+    WorkerOptions worker_opt;
+    Watcher watcher;
+    RulePool pool;
+
+    // Главный цикл: проходы идут в offload, реактор тем временем принимает сигналы.
+    Reactor reactor;
+    Offload offload;
+    int signal_fd = -1;
+    int timer_fd = -1;
+    int watched_fd = -1;   // inotify, зарегистрированный в реакторе
+    bool sweep_due = false; // полный проход: старт, перечитывание, потеря событий
+    Scheduler scheduler;    // сроки групп (индекс в sources)
+    std::mt19937_64 rng;    // jitter
+    bool events_pending = false;
+    // Ставит поток реактора (сигналы — через signalfd), читают потоки прохода,
+    // копирования, пула дерева и управления.
+    std::atomic<bool> reload{false};
+    std::atomic<bool> stop{false};
+    std::atomic<bool> handover{false}; // SIGUSR1: новый экземпляр забирает дела
 };
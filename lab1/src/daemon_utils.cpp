@@ -1,8 +1,9 @@
 #include "daemon_utils.h"
+#include "log.h"
 
+#include <sys/file.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <syslog.h>
 #include <unistd.h>
 #include <signal.h>
 #include <fcntl.h>
@@ -12,6 +13,7 @@
 #include <string>
 
 #include <cerrno>
+#include <cstdio>
 
 namespace fs = std::filesystem;
 
@@ -28,20 +30,20 @@ static bool proc_exists(pid_t pid) {
 void daemonize() {
     pid_t pid = fork();
     if (pid < 0) {
-        syslog(LOG_ERR, "fork #1: %m");
+        log_msg(LOG_ERR, "fork #1: %m");
         _exit(1);
     }
     if (pid > 0)
         _exit(0);
 
     if (setsid() < 0) {
-        syslog(LOG_ERR, "setsid: %m");
+        log_msg(LOG_ERR, "setsid: %m");
         _exit(1);
     }
 
     pid = fork();
     if (pid < 0) {
-        syslog(LOG_ERR, "fork #2: %m");
+        log_msg(LOG_ERR, "fork #2: %m");
         _exit(1);
     }
     if (pid > 0)
@@ -50,60 +52,92 @@ void daemonize() {
     umask(0);
 
     if (chdir("/") != 0) {
-        syslog(LOG_ERR, "chdir('/'): %m");
+        log_msg(LOG_ERR, "chdir('/'): %m");
         _exit(1);
     }
 
     int fd0 = open("/dev/null", O_RDWR);
     if (fd0 < 0) {
-        syslog(LOG_ERR, "open /dev/null: %m");
+        log_msg(LOG_ERR, "open /dev/null: %m");
         _exit(1);
     }
     if (dup2(fd0, STDIN_FILENO)  == -1) {
-        syslog(LOG_ERR, "dup2 stdin: %m");
+        log_msg(LOG_ERR, "dup2 stdin: %m");
         _exit(1);
     }
     if (dup2(fd0, STDOUT_FILENO) == -1) {
-        syslog(LOG_ERR, "dup2 stdout: %m");
+        log_msg(LOG_ERR, "dup2 stdout: %m");
         _exit(1);
     }
     if (dup2(fd0, STDERR_FILENO) == -1) {
-        syslog(LOG_ERR, "dup2 stderr: %m");
+        log_msg(LOG_ERR, "dup2 stderr: %m");
         _exit(1);
     }
     if (fd0 > 2)
         close(fd0);
 }
 
-void ensure_singleton(const std::string &pid_path) {
-    std::ifstream pin(pid_path);
-    if (pin) {
-        pid_t old = 0; pin >> old;
-        if (proc_exists(old) || proc_alive(old)) {
-            syslog(LOG_INFO, "found running instance pid=%d, sending SIGTERM", old);
-            kill(old, SIGTERM);
-            for (int i = 0; i < 50; ++i) {
-                usleep(100000); // 0.1s
-                if (!(proc_exists(old) || proc_alive(old)))
-                    break;
-            }
+int lock_pid_file(const std::string &pid_path, bool wait) {
+    std::error_code ec;
+    fs::create_directories(fs::path(pid_path).parent_path(), ec);
+    for (;;) {
+        int fd = open(pid_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            log_msg(LOG_ERR, "cannot open pid file %s: %m", pid_path.c_str());
+            return -1;
         }
-        else {
-            syslog(LOG_WARNING, "stale pid file at %s; removing", pid_path.c_str());
-            std::error_code ec;
-            fs::remove(pid_path, ec);
+        if (flock(fd, LOCK_EX | (wait ? 0 : LOCK_NB)) != 0) {
+            int err = errno;
+            close(fd);
+            if (err == EINTR)
+                continue;
+            errno = err;
+            return -1;
         }
+        // пока ждали, прежний владелец мог удалить файл — блокировка тогда на чужом inode
+        struct stat held{}, now{};
+        if (fstat(fd, &held) == 0 && stat(pid_path.c_str(), &now) == 0 && held.st_dev == now.st_dev &&
+            held.st_ino == now.st_ino)
+            return fd;
+        close(fd);
     }
 }
 
-void write_pid(const std::string &pid_path) {
-    std::error_code ec;
-    fs::create_directories(fs::path(pid_path).parent_path(), ec);
+pid_t read_pid(const std::string &pid_path) {
+    std::ifstream pin(pid_path);
+    pid_t pid = 0;
+    pin >> pid;
+    return pid;
+}
 
-    std::ofstream pout(pid_path, std::ios::trunc);
-    if (!pout) {
-        syslog(LOG_ERR, "cannot write pid file: %s", pid_path.c_str());
+static std::string comm_of(const std::string &pid) {
+    std::ifstream in("/proc/" + pid + "/comm");
+    std::string comm;
+    std::getline(in, comm);
+    return comm;
+}
+
+void ensure_singleton(const std::string &pid_path) {
+    pid_t old = read_pid(pid_path);
+    if (old == getpid() || !(proc_exists(old) || proc_alive(old)))
+        return;
+    // номер мог достаться постороннему процессу
+    if (comm_of(std::to_string(old)) != comm_of("self")) {
+        log_msg(LOG_WARNING, "stale pid file at %s (pid %d is not lab1d)", pid_path.c_str(), old);
         return;
     }
-    pout << getpid() << "\n";
-}
\ No newline at end of file
+    log_msg(LOG_INFO, "found running instance pid=%d without pid file lock, sending SIGTERM", old);
+    kill(old, SIGTERM);
+    for (int i = 0; i < 50; ++i) {
+        usleep(100000); // 0.1s
+        if (!(proc_exists(old) || proc_alive(old)))
+            break;
+    }
+}
+
+void write_pid(int pid_fd) {
+    char buf[32];
+    int len = std::snprintf(buf, sizeof(buf), "%d\n", int(getpid()));
+    if (pid_fd < 0 || ftruncate(pid_fd, 0) != 0 || pwrite(pid_fd, buf, size_t(len), 0) != len)
+        log_msg(LOG_ERR, "cannot write pid file: %m");
+}
@@ -1,7 +1,17 @@
 #pragma once
 
+#include <sys/types.h>
+
 #include <string>
 
 void daemonize();
+
+// Открывает pid-файл и берёт на нём flock. Дескриптор держится до выхода, так что
+// владение переходит к следующему экземпляру атомарно, когда этот закрывает файл.
+// -1 и errno=EWOULDBLOCK — файл держит живой экземпляр (wait=false).
+int lock_pid_file(const std::string &pid_path, bool wait);
+pid_t read_pid(const std::string &pid_path);
+// Экземпляр прежней версии pid-файл не блокирует: если записанный там процесс —
+// такой же демон, ему отправляется SIGTERM, как раньше.
 void ensure_singleton(const std::string &pid_path);
-void write_pid(const std::string &pid_path);
\ No newline at end of file
+void write_pid(int pid_fd);
@@ -0,0 +1,189 @@
+#include "dest_index.h"
+#include "xxhash64.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <string_view>
+
+// Разбиение как у fs::path: расширение — от последней точки, кроме ведущей.
+static void split_name(std::string_view name, std::string_view &stem, std::string_view &ext) {
+    auto dot = name.rfind('.');
+    if (dot == std::string_view::npos || dot == 0) {
+        stem = name;
+        ext = {};
+        return;
+    }
+    stem = name.substr(0, dot);
+    ext = name.substr(dot);
+}
+
+// "report(12)" -> base "report", n = 12
+static bool parse_suffix(std::string_view stem, std::string_view &base, unsigned long &n) {
+    if (stem.size() < 3 || stem.back() != ')')
+        return false;
+    auto open = stem.rfind('(');
+    if (open == std::string_view::npos || open + 2 > stem.size() - 1)
+        return false;
+    unsigned long v = 0;
+    for (size_t i = open + 1; i < stem.size() - 1; ++i) {
+        char c = stem[i];
+        if (c < '0' || c > '9')
+            return false;
+        v = v * 10 + static_cast<unsigned long>(c - '0');
+    }
+    base = stem.substr(0, open);
+    n = v;
+    return true;
+}
+
+static std::string key_of(std::string_view stem, std::string_view ext) {
+    std::string k;
+    k.reserve(stem.size() + ext.size() + 1);
+    k.append(stem).push_back('/'); // '/' не встречается в именах файлов
+    k.append(ext);
+    return k;
+}
+
+void DestIndex::add(const std::string &name) {
+    names_.insert(name);
+    std::string_view stem, ext, base;
+    split_name(name, stem, ext);
+    unsigned long n = 0;
+    if (!parse_suffix(stem, base, n))
+        return;
+    auto &m = max_suffix_[key_of(base, ext)];
+    if (n > m)
+        m = n;
+}
+
+void DestIndex::build() {
+    built_ = true;
+    std::error_code ec;
+    for (fs::directory_iterator it(dir(), ec), end; !ec && it != end; it.increment(ec))
+        add(it->path().filename().string());
+}
+
+static uint64_t hint_key(const std::string &key);
+
+bool DestIndex::taken(const std::string &name) {
+    if (!names_.count(name))
+        return false;
+    if (!verify_ || faccessat(fd(), name.c_str(), F_OK, AT_SYMLINK_NOFOLLOW) == 0)
+        return true;
+    names_.erase(name);
+    return false;
+}
+
+std::string DestIndex::next_name(std::string_view base) {
+    std::string name(base);
+    if (!taken(name))
+        return name;
+    std::string_view stem, ext;
+    split_name(base, stem, ext);
+    std::string key = key_of(stem, ext);
+    auto &m = max_suffix_[key];
+    do {
+        name.assign(stem);
+        name += "(" + std::to_string(++m) + ")";
+        name.append(ext);
+    } while (taken(name));
+    touch(hint_key(key), m);
+    return name;
+}
+
+// renameat2(RENAME_NOREPLACE), а там, где ФС его не умеет, — проверка и renameat.
+static int rename_noreplace(int from_fd, const char *from, int to_fd, const char *to) {
+    if (renameat2(from_fd, from, to_fd, to, RENAME_NOREPLACE) == 0)
+        return 0;
+    if (errno != EINVAL && errno != ENOSYS)
+        return errno;
+    if (faccessat(to_fd, to, F_OK, AT_SYMLINK_NOFOLLOW) == 0)
+        return EEXIST;
+    if (renameat(from_fd, from, to_fd, to) == 0)
+        return 0;
+    return errno;
+}
+
+static constexpr int kHintTries = 4;
+static constexpr size_t kTouched = 64;
+
+static uint64_t hint_key(const std::string &key) {
+    return xxh64(key.data(), key.size());
+}
+
+void DestIndex::seed_hint(uint64_t key, unsigned long max) {
+    auto &m = hints_[key];
+    if (max > m)
+        m = max;
+}
+
+// В снимок идут только недавние коллизии: полный индекс может быть огромным,
+// а сохраняется он каждый тик.
+void DestIndex::touch(uint64_t key, unsigned long max) {
+    if (touched_.size() >= kTouched && !touched_.count(key))
+        touched_.erase(touched_.begin());
+    touched_[key] = max;
+}
+
+void DestIndex::for_each_suffix(const std::function<void(uint64_t key, unsigned long max)> &fn) const {
+    for (const auto &[key, max] : hints_)
+        if (!touched_.count(key))
+            fn(key, max);
+    for (const auto &[key, max] : touched_)
+        fn(key, max);
+}
+
+// Следующее имя по подсказке; пусто — подсказки нет или она не помогла.
+std::string DestIndex::hinted_name(std::string_view base, int &tries) {
+    if (hints_.empty() || tries >= kHintTries)
+        return {};
+    std::string_view stem, ext;
+    split_name(base, stem, ext);
+    auto it = hints_.find(hint_key(key_of(stem, ext)));
+    if (it == hints_.end())
+        return {};
+    ++tries;
+    std::string name(stem);
+    name += "(" + std::to_string(++it->second) + ")";
+    name.append(ext);
+    touch(it->first, it->second);
+    return name;
+}
+
+int DestIndex::commit(int from_fd, const char *from_name, const char *base, fs::path *placed) {
+    int to_fd = fd();
+    if (to_fd < 0)
+        return errno;
+    // Без коллизий индекс не нужен вовсе: первая попытка — под исходным именем.
+    int tries = 0;
+    std::string name;
+    for (int attempt = 0; attempt < 1000; ++attempt) {
+        const char *target = base;
+        if (built_) {
+            name = next_name(base);
+            target = name.c_str();
+        } else if (attempt > 0) {
+            if ((name = hinted_name(base, tries)).empty()) {
+                build();
+                name = next_name(base);
+            }
+            target = name.c_str();
+        }
+        int err = rename_noreplace(from_fd, from_name, to_fd, target);
+        if (err == 0) {
+            if (built_)
+                add(target);
+            if (placed)
+                *placed = dir() / target;
+            return 0;
+        }
+        if (err != EEXIST)
+            return err;
+        if (built_)
+            add(target);
+    }
+    return EEXIST;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "dir_fd.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+// Индекс занятых имён каталога назначения. Строится лениво, при первой
+// коллизии, и пополняется по мере переноса файлов. Для каждой пары (stem, ext)
+// хранит наибольший встреченный суффикс "(N)", так что следующее свободное
+// имя вычисляется без перебора. Индекс может жить дольше одного прохода:
+// после begin_pass() имена из него перепроверяются на диске перед тем, как
+// считать их занятыми (их могли забрать потребители).
+// Все операции — относительно дескриптора каталога (renameat2/faccessat по имени).
+class DestIndex {
+public:
+    explicit DestIndex(fs::path dir) : dir_(std::move(dir)) {}
+
+    const fs::path &dir() const { return dir_.path(); }
+    int fd() { return dir_.get(); }
+    void adopt_fd(int fd) { dir_.adopt(fd); }
+    void begin_pass() {
+        verify_ = built_;
+        dir_.refresh();
+    }
+
+    // Атомарно переносит from_name из каталога from_fd сюда под именем base или base(N).
+    // Возвращает 0 (итоговый путь — в *placed, если он нужен), иначе errno
+    // (EXDEV — другое устройство). Без коллизий ничего не выделяет в куче.
+    int commit(int from_fd, const char *from_name, const char *base, fs::path *placed = nullptr);
+    // Имя, занятое в обход commit() (пакетный rename через io_uring).
+    void note(const char *name) {
+        if (built_)
+            add(name);
+    }
+
+    // Подсказки из снимка состояния: key — xxh64(stem + '/' + ext), max — наибольший
+    // суффикс. До построения индекса коллизия сначала пробует max+1 и дальше,
+    // и только если и там занято, каталог читается целиком.
+    void seed_hint(uint64_t key, unsigned long max);
+    void for_each_suffix(const std::function<void(uint64_t key, unsigned long max)> &fn) const;
+
+private:
+    void build();
+    void add(const std::string &name);
+    std::string next_name(std::string_view base);
+    bool taken(const std::string &name);
+    std::string hinted_name(std::string_view base, int &tries);
+    void touch(uint64_t key, unsigned long max);
+
+    DirFd dir_;
+    bool built_ = false;
+    bool verify_ = false;
+    std::unordered_set<std::string> names_;
+    std::unordered_map<std::string, unsigned long> max_suffix_; // stem + '/' + ext
+    std::unordered_map<uint64_t, unsigned long> hints_;
+    std::unordered_map<uint64_t, unsigned long> touched_; // недавние коллизии, для снимка
+};
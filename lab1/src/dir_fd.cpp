@@ -0,0 +1,48 @@
+#include "dir_fd.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+DirFd::~DirFd() {
+    close_fd();
+}
+
+void DirFd::close_fd() {
+    if (fd_ >= 0)
+        close(fd_);
+    fd_ = -1;
+}
+
+int DirFd::get() {
+    if (fd_ >= 0)
+        return fd_;
+    fd_ = open(dir_.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    struct stat st{};
+    if (fd_ >= 0 && fstat(fd_, &st) == 0) {
+        dev_ = st.st_dev;
+        ino_ = st.st_ino;
+    }
+    return fd_;
+}
+
+void DirFd::adopt(int fd) {
+    close_fd();
+    struct stat st{};
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    fd_ = fd;
+    dev_ = st.st_dev;
+    ino_ = st.st_ino;
+}
+
+void DirFd::refresh() {
+    if (fd_ < 0)
+        return;
+    struct stat st{};
+    if (stat(dir_.c_str(), &st) != 0 || st.st_dev != dev_ || st.st_ino != ino_)
+        close_fd();
+}
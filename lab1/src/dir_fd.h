@@ -0,0 +1,35 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Дескриптор каталога (O_PATH) для *at()-вызовов: имя файла разбирается
+// относительно него, без повторного прохода по всему пути. Открывается при
+// первом обращении; refresh() сверяет его с путём (одна stat() на проход),
+// так что каталог, пересозданный под тем же именем, открывается заново.
+class DirFd {
+public:
+    explicit DirFd(fs::path dir) : dir_(std::move(dir)) {}
+    ~DirFd();
+    DirFd(const DirFd &) = delete;
+    DirFd &operator=(const DirFd &) = delete;
+
+    const fs::path &path() const { return dir_; }
+    // -1 — каталог не открылся (errno сохранён).
+    int get();
+    void refresh();
+    // Берёт готовый дескриптор (например, переданный прежним экземпляром);
+    // если он не про тот каталог, refresh() его заменит.
+    void adopt(int fd);
+
+private:
+    void close_fd();
+
+    fs::path dir_;
+    int fd_ = -1;
+    dev_t dev_ = 0;
+    ino_t ino_ = 0;
+};
@@ -0,0 +1,109 @@
+#include "dir_scanner.h"
+#include "log.h"
+
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static constexpr size_t kDentBuf = 1 << 20;
+
+static unsigned char type_of_mode(mode_t m) {
+    if (S_ISREG(m)) return DT_REG;
+    if (S_ISDIR(m)) return DT_DIR;
+    if (S_ISLNK(m)) return DT_LNK;
+    return DT_UNKNOWN;
+}
+
+// Тип записи через statx там, где getdents64 его не сообщил (DT_UNKNOWN)
+// и для ссылок, которые, как и раньше, обрабатываются по типу цели.
+static unsigned char resolve_type(int dirfd, const char *name, bool follow) {
+    struct statx sx{};
+    int flags = AT_STATX_DONT_SYNC | (follow ? 0 : AT_SYMLINK_NOFOLLOW);
+    if (statx(dirfd, name, flags, STATX_TYPE, &sx) != 0)
+        return DT_UNKNOWN;
+    return type_of_mode(sx.stx_mode);
+}
+
+bool scan_dir_each(const fs::path &dir, const ScanFn &fn, ScanInfo &info) {
+    auto t0 = std::chrono::steady_clock::now();
+    info = ScanInfo{};
+
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        log_msg(LOG_ERR, "cannot open source dir %s: %m", dir.c_str());
+        return false;
+    }
+
+    static thread_local std::vector<char> buf(kDentBuf);
+    bool ok = true;
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buf.data(), buf.size());
+        if (n < 0) {
+            log_msg(LOG_ERR, "getdents64 %s: %m", dir.c_str());
+            ok = false;
+            break;
+        }
+        if (n == 0)
+            break;
+        for (long pos = 0; pos < n; ) {
+            auto *d = reinterpret_cast<linux_dirent64 *>(buf.data() + pos);
+            pos += d->d_reclen;
+
+            const char *nm = d->d_name;
+            if (nm[0] == '.' && (nm[1] == '\0' || (nm[1] == '.' && nm[2] == '\0')))
+                continue;
+
+            unsigned char type = d->d_type;
+            if (type == DT_UNKNOWN) {
+                type = resolve_type(fd, nm, false);
+                ++info.statx_calls;
+            }
+            if (type == DT_LNK) {
+                type = resolve_type(fd, nm, true);
+                ++info.statx_calls;
+            }
+            ++info.entries;
+            fn(d->d_ino, type, nm, std::strlen(nm));
+        }
+    }
+    close(fd);
+    info.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return ok;
+}
+
+bool scan_dir(const fs::path &dir, DirSnapshot &out) {
+    out.entries.clear();
+    out.names.clear();
+    ScanInfo info;
+    bool ok = scan_dir_each(dir, [&](uint64_t ino, unsigned char type, const char *name, size_t len) {
+        DirEntry e;
+        e.ino = ino;
+        e.name_off = static_cast<uint32_t>(out.names.size());
+        e.name_len = static_cast<uint16_t>(len);
+        e.type = type;
+        out.names.append(name, len + 1);
+        out.entries.push_back(e);
+    }, info);
+
+    // Порядок inode близок к порядку размещения на ext4/xfs.
+    std::sort(out.entries.begin(), out.entries.end(),
+              [](const DirEntry &a, const DirEntry &b) { return a.ino < b.ino; });
+
+    out.statx_calls = info.statx_calls;
+    out.seconds = info.seconds;
+    return ok;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct DirEntry {
+    uint64_t ino;
+    uint32_t name_off; // смещение имени в DirSnapshot::names
+    uint16_t name_len;
+    unsigned char type; // DT_*; для символических ссылок — тип цели
+};
+
+// Снимок каталога, прочитанный через getdents64 до начала обработки:
+// переименования во время прохода не влияют на перечисление.
+struct DirSnapshot {
+    std::vector<DirEntry> entries; // без "." и "..", по возрастанию inode
+    std::string names;             // имена подряд, каждое завершается '\0'
+    size_t statx_calls = 0;
+    double seconds = 0;
+
+    const char *name(const DirEntry &e) const { return names.data() + e.name_off; }
+};
+
+struct ScanInfo {
+    size_t entries = 0;
+    size_t statx_calls = 0;
+    double seconds = 0;
+};
+
+// Потоковый вариант: каждая запись отдаётся в fn прямо из буфера getdents64,
+// ничего не накапливается — память не зависит от размера каталога.
+using ScanFn = std::function<void(uint64_t ino, unsigned char type, const char *name, size_t len)>;
+bool scan_dir_each(const fs::path &dir, const ScanFn &fn, ScanInfo &info);
+
+bool scan_dir(const fs::path &dir, DirSnapshot &out);
@@ -1,41 +1,963 @@
 #include "file_worker.h"
+#include "commit.h"
+#include "content_index.h"
+#include "dir_scanner.h"
+#include "log.h"
+#include "metrics.h"
+#include "state_file.h"
+#include "transfer.h"
+#include "uring.h"
 #include "utils.h"
+#include "work_stealing.h"
 
-#include <syslog.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <set>
 
-void process_rule(const Rule &r) {
-    size_t moved = 0, skipped = 0;
-    for (auto &de : fs::directory_iterator(r.from)) {
-        if (!de.is_regular_file()) {
-            ++skipped;
-            continue;
+static constexpr unsigned kRingEntries = 256;
+// Кандидатов на правило за тик, если max_files не задан: память на отбор ограничена
+// и без бюджета, а остаток уходит в хвост и разбирается следующими тиками.
+static constexpr size_t kSelectionCap = 1 << 16;
+static constexpr size_t kMethods = static_cast<size_t>(TransferMethod::Hardlink) + 1;
+
+struct MoveStats {
+    size_t moved = 0;
+    size_t skipped = 0;
+    size_t copied = 0; // из moved — через межустройственный перенос
+    size_t by_method[kMethods] = {};
+    size_t errors = 0;
+    uint64_t bytes = 0;
+    size_t deduped = 0;
+    uint64_t dedup_bytes = 0;
+    size_t scanned = 0;
+    double scan_sec = 0;
+    bool backlog = false;
+    RuleMetrics *metrics = nullptr;
+    Throttle *throttle = nullptr; // лимиты скорости правила; общий на потоки прохода
+    CommitBatch *commit = nullptr; // durability: источники скопированных удаляются после сброса пачки
+};
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t us_since(Clock::time_point t0) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+}
+
+static void flush_metrics(const MoveStats &st) {
+    RuleMetrics *m = st.metrics;
+    if (!m)
+        return;
+    bump(m->moved, st.moved);
+    bump(m->renamed, st.moved - st.copied);
+    bump(m->copied, st.copied);
+    bump(m->bytes, st.bytes);
+    bump(m->errors, st.errors);
+    bump(m->deduped, st.deduped);
+    bump(m->dedup_bytes, st.dedup_bytes);
+    if (st.scanned) {
+        bump(m->scanned, st.scanned);
+        hist_add(m->scan_us, static_cast<uint64_t>(st.scan_sec * 1e6));
+    }
+}
+
+// ENOENT от rename: источник пропал между чтением каталога и переносом (его
+// забрали или удалили) — это не ошибка; иначе пропало назначение.
+static bool source_gone(int from_fd, const char *name) {
+    return faccessat(from_fd, name, F_OK, AT_SYMLINK_NOFOLLOW) != 0 && errno == ENOENT;
+}
+
+// Файл name из каталога from_fd; from_dir — путь этого каталога, нужен только
+// для сообщений и межустройственного копирования.
+static bool move_file(int from_fd, const char *name, const fs::path &from_dir, DestIndex &dest, MoveStats &st,
+                      fs::path *placed = nullptr) {
+    if (st.throttle)
+        st.throttle->op();
+    auto t0 = Clock::now();
+    int err = dest.commit(from_fd, name, name, placed);
+    if (err == 0) {
+        ++st.moved;
+        if (st.metrics)
+            hist_add(st.metrics->move_us, us_since(t0));
+        return true;
+    }
+    if (err == ENOENT && source_gone(from_fd, name)) {
+        log_msg(LOG_DEBUG, "%s/%s is gone; skipped", from_dir.c_str(), name);
+        return false;
+    }
+    if (err != EXDEV) {
+        log_msg(LOG_ERR, "rename failed: %s/%s -> %s: %s", from_dir.c_str(), name, dest.dir().c_str(), std::strerror(err));
+        ++st.errors;
+        return false;
+    }
+
+    TransferResult tr = transfer_file(from_fd, name, from_dir, dest, !st.commit, st.throttle);
+    if (!tr.ok) {
+        if (!tr.suspended)
+            ++st.errors;
+        return false;
+    }
+    log_msg(LOG_DEBUG, "copied %s/%s -> %s via %s (%llu bytes)", from_dir.c_str(), name, tr.dst.c_str(),
+           transfer_method_name(tr.method), (unsigned long long)tr.bytes);
+    ++st.moved;
+    ++st.copied;
+    ++st.by_method[static_cast<size_t>(tr.method)];
+    st.bytes += tr.bytes;
+    if (st.metrics)
+        hist_add(st.metrics->move_us, us_since(t0));
+    if (placed)
+        *placed = tr.dst;
+    if (st.commit)
+        st.commit->add(from_fd, name, from_dir, dest.fd(), std::move(tr.dst), tr.journal);
+    return true;
+}
+
+// fanout=: файл доставляется в to и во все r.fanout (fanout_file). Если to на той же
+// ФС, что и источник, источник уезжает туда последним, обычным rename, — после
+// того как удались остальные доставки; иначе to входит в общий проход копирования,
+// и источник удаляется после всех (с durability — вместе с пачкой).
+static bool move_fanout(const Rule &r, int from_fd, const char *name, const fs::path &from_dir, DestIndex &dest,
+                        MoveStats &st) {
+    auto t0 = Clock::now();
+    std::vector<DestIndex *> dests;
+    for (const auto &d : r.state->fanout)
+        dests.push_back(d.get());
+    struct stat ds{};
+    const bool rename_last = dest.fd() >= 0 && fstat(dest.fd(), &ds) == 0 && ds.st_dev == r.state->src_dev;
+    if (!rename_last) {
+        dests.insert(dests.begin(), &dest);
+        if (st.throttle)
+            st.throttle->op();
+    }
+
+    FanoutResult fr = fanout_file(from_fd, name, from_dir, dests, st.throttle);
+    if (!fr.ok) {
+        if (!fr.suspended)
+            ++st.errors;
+        return false;
+    }
+    for (const Delivery &d : fr.copies)
+        ++st.by_method[static_cast<size_t>(d.method)];
+    st.bytes += fr.bytes;
+    std::vector<CommitBatch::Copy> copies;
+    for (size_t i = 0; i < dests.size(); ++i)
+        copies.push_back(CommitBatch::Copy{dests[i]->fd(), std::move(fr.copies[i].dst), fr.copies[i].journal});
+
+    if (rename_last) {
+        if (!move_file(from_fd, name, from_dir, dest, st)) {
+            // источник остался — убираем доставки, иначе следующий проход их повторит
+            for (const CommitBatch::Copy &c : copies) {
+                unlinkat(c.to_fd, c.dst.filename().c_str(), 0);
+                state_copy_end(c.journal);
+            }
+            return false;
+        }
+        if (st.commit) {
+            st.commit->add(from_fd, nullptr, from_dir, std::move(copies));
+        } else {
+            for (const CommitBatch::Copy &c : copies)
+                state_copy_end(c.journal);
+        }
+        return true;
+    }
+
+    ++st.moved;
+    ++st.copied;
+    if (st.metrics)
+        hist_add(st.metrics->move_us, us_since(t0));
+    if (st.commit) {
+        st.commit->add(from_fd, name, from_dir, std::move(copies));
+        return true;
+    }
+    for (const CommitBatch::Copy &c : copies)
+        state_copy_placed(c.journal, c.dst);
+    if (unlinkat(from_fd, name, 0) != 0)
+        log_msg(LOG_ERR, "fanout: remove source %s/%s: %m", from_dir.c_str(), name);
+    for (const CommitBatch::Copy &c : copies)
+        state_copy_end(c.journal);
+    return true;
+}
+
+// Перенос с dedupe=: если в назначении уже лежит файл с тем же содержимым,
+// источник удаляется (drop) или в назначении появляется жёсткая ссылка на
+// имеющийся файл под именем источника (link) — данные не копируются.
+static bool deliver(const Rule &r, int from_fd, const char *name, const fs::path &from_dir, DestIndex &dest,
+                    ContentIndex *dup, MoveStats &st) {
+    if (st.commit)
+        st.commit->due();
+    if (!r.fanout.empty())
+        return move_fanout(r, from_fd, name, from_dir, dest, st);
+    if (!dup)
+        return move_file(from_fd, name, from_dir, dest, st);
+    Fingerprint fp;
+    int fd = openat(from_fd, name, O_RDONLY | O_CLOEXEC);
+    bool ok = fd >= 0 && fingerprint_stat(fd, fp);
+    if (fd >= 0)
+        close(fd);
+    if (!ok)
+        return move_file(from_fd, name, from_dir, dest, st);
+
+    const fs::path src = from_dir / name;
+    std::string same;
+    if (dup->find(src, fp, same)) {
+        if (st.throttle)
+            st.throttle->op();
+        if (r.dedupe == Dedupe::Link) {
+            static std::atomic<unsigned long> seq{0};
+            char tmp[64];
+            std::snprintf(tmp, sizeof(tmp), ".lab1d-link-%d-%lu.part", int(getpid()), seq++);
+            fs::path linked;
+            if (linkat(dest.fd(), same.c_str(), dest.fd(), tmp, 0) != 0) {
+                log_msg(LOG_ERR, "dedupe: link %s: %m", same.c_str());
+                ++st.errors;
+                return false;
+            }
+            int err = dest.commit(dest.fd(), tmp, name, &linked);
+            if (err != 0) {
+                log_msg(LOG_ERR, "dedupe: %s -> %s: %s", src.c_str(), dest.dir().c_str(), std::strerror(err));
+                unlinkat(dest.fd(), tmp, 0);
+                ++st.errors;
+                return false;
+            }
+            dup->add(linked.filename().string(), fp);
+        }
+        if (unlinkat(from_fd, name, 0) != 0) {
+            log_msg(LOG_ERR, "dedupe: remove source %s: %m", src.c_str());
+            ++st.errors;
+            return false;
+        }
+        log_msg(LOG_DEBUG, "dedupe: %s same as %s", src.c_str(), (dest.dir() / same).c_str());
+        ++st.deduped;
+        st.dedup_bytes += fp.size;
+        return true;
+    }
+
+    fs::path placed;
+    if (!move_file(from_fd, name, from_dir, dest, st, &placed))
+        return false;
+    const std::string placed_name = placed.filename().string();
+    // после копирования на другое устройство mtime новый — хеши остаются верными
+    fd = openat(dest.fd(), placed_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        Fingerprint now;
+        if (fingerprint_stat(fd, now))
+            fp.mtime_ns = now.mtime_ns;
+        close(fd);
+    }
+    dup->add(placed_name, fp);
+    return true;
+}
+
+static std::shared_ptr<ContentIndex> content_index_for(const Rule &r, const fs::path &to) {
+    return r.dedupe == Dedupe::Off ? nullptr : ContentIndex::of(to);
+}
+
+struct Candidate {
+    uint64_t key;      // inode, отсчитанный от курсора группы по кругу
+    uint32_t name_off; // смещение имени в арене Selection
+    uint16_t name_len;
+};
+
+// Отбор файлов правила за тик. Хранится не больше cap кандидатов
+// с наименьшими ключами (max-heap), так что память не зависит от размера каталога.
+// Имена лежат подряд в одной арене (как в DirSnapshot), без выделения на файл;
+// вытесненные из кучи имена выбрасываются, когда мёртвого места больше живого.
+class Selection {
+public:
+    explicit Selection(size_t cap) : cap_(cap) {}
+
+    void offer(uint64_t key, const char *name, size_t len) {
+        if (cap_ == 0 || items_.size() < cap_) {
+            items_.push_back(Candidate{key, store(name, len), uint16_t(len)});
+            if (cap_)
+                std::push_heap(items_.begin(), items_.end(), by_key);
+            return;
         }
-        const auto &src = de.path();
-        std::string ex = ext_lower_of(src);
-        if (ex == r.ext) {
-            ++skipped;
+        ++overflow_;
+        if (key >= items_.front().key)
+            return;
+        std::pop_heap(items_.begin(), items_.end(), by_key);
+        live_ -= items_.back().name_len + 1u;
+        items_.back() = Candidate{key, store(name, len), uint16_t(len)};
+        std::push_heap(items_.begin(), items_.end(), by_key);
+        if (names_.size() > 2 * live_ + kSlack)
+            compact();
+    }
+
+    void finish() { std::sort(items_.begin(), items_.end(), by_key); }
+
+    const std::vector<Candidate> &items() const { return items_; }
+    const char *name(const Candidate &c) const { return names_.data() + c.name_off; }
+    size_t overflow() const { return overflow_; }
+
+private:
+    static constexpr size_t kSlack = 64 << 10;
+
+    static bool by_key(const Candidate &a, const Candidate &b) { return a.key < b.key; }
+
+    uint32_t store(const char *name, size_t len) {
+        auto off = static_cast<uint32_t>(names_.size());
+        names_.append(name, len).push_back('\0');
+        live_ += len + 1;
+        return off;
+    }
+
+    void compact() {
+        std::string fresh;
+        fresh.reserve(live_);
+        for (Candidate &c : items_) {
+            auto off = static_cast<uint32_t>(fresh.size());
+            fresh.append(names_, c.name_off, c.name_len + 1u);
+            c.name_off = off;
+        }
+        names_.swap(fresh);
+    }
+
+    size_t cap_;
+    size_t overflow_ = 0;
+    size_t live_ = 0;
+    std::vector<Candidate> items_;
+    std::string names_;
+};
+
+// Проверяется между файлами: бюджет правила и сигналы демону.
+struct Limiter {
+    const Budget &budget;
+    const WorkerOptions &opt;
+    Clock::time_point t0 = Clock::now();
+
+    bool exhausted(const MoveStats &st) const {
+        if (opt.interrupted())
+            return true;
+        if (budget.max_bytes && st.bytes >= budget.max_bytes)
+            return true;
+        return budget.max_ms && us_since(t0) >= uint64_t(budget.max_ms) * 1000;
+    }
+};
+
+// Первое по порядку конфига правило группы, которое берёт файл; size() — никакое.
+static size_t route(const SourceGroup &g, const char *name, size_t len) {
+    if (is_transfer_temp(name))
+        return g.rules.size();
+    size_t i = 0;
+    while (i < g.rules.size() && !g.rules[i]->match.matches(name, len))
+        ++i;
+    return i;
+}
+
+static void log_summary(const char *kind, const Rule &r, const MoveStats &st) {
+    char scan[64] = "";
+    if (st.scanned)
+        std::snprintf(scan, sizeof(scan), " scanned=%zu (%.0f/s)", st.scanned, st.scan_sec > 0 ? st.scanned / st.scan_sec : 0.0);
+    char more[160];
+    int len = std::snprintf(more, sizeof(more), "%s", st.backlog ? " backlog" : "");
+    if (st.deduped)
+        len += std::snprintf(more + len, sizeof(more) - size_t(len), " deduped=%zu", st.deduped);
+    if (r.rate.bytes)
+        len += std::snprintf(more + len, sizeof(more) - size_t(len), " limit=%lluB/s", (unsigned long long)r.rate.bytes);
+    if (r.rate.ops)
+        len += std::snprintf(more + len, sizeof(more) - size_t(len), " limit=%lluop/s", (unsigned long long)r.rate.ops);
+    if (size_t linked = st.by_method[static_cast<size_t>(TransferMethod::Hardlink)])
+        len += std::snprintf(more + len, sizeof(more) - size_t(len), " linked=%zu", linked);
+    if (uint64_t us = st.throttle ? st.throttle->waited_us() : 0)
+        std::snprintf(more + len, sizeof(more) - size_t(len), " throttled=%llums", (unsigned long long)(us / 1000));
+    if (st.copied == 0) {
+        log_msg(LOG_INFO, "%s: from=%s to=%s filter=%s moved=%zu skipped=%zu%s%s", kind, r.from.c_str(), r.to.c_str(), r.spec.c_str(), st.moved, st.skipped, scan, more);
+        return;
+    }
+    log_msg(LOG_INFO, "%s: from=%s to=%s filter=%s moved=%zu skipped=%zu%s%s copied=%zu (reflink=%zu cfr=%zu sendfile=%zu splice=%zu rw=%zu)",
+           kind, r.from.c_str(), r.to.c_str(), r.spec.c_str(), st.moved, st.skipped, scan, more, st.copied,
+           st.by_method[static_cast<size_t>(TransferMethod::Reflink)],
+           st.by_method[static_cast<size_t>(TransferMethod::CopyFileRange)],
+           st.by_method[static_cast<size_t>(TransferMethod::Sendfile)],
+           st.by_method[static_cast<size_t>(TransferMethod::Splice)],
+           st.by_method[static_cast<size_t>(TransferMethod::ReadWrite)]);
+}
+
+// Кольцо на поток пула; если io_uring недоступен, переходим на синхронный путь.
+static Uring *thread_ring() {
+    static thread_local Uring ring;
+    static thread_local bool tried = false;
+    if (!tried) {
+        tried = true;
+        if (!ring.init(kRingEntries))
+            log_msg(LOG_WARNING, "io_uring unavailable: %m; using synchronous moves");
+    }
+    return ring.ready() ? &ring : nullptr;
+}
+
+// Ждёт n завершений и отдаёт их в on_cqe(user_data, res).
+template <class F>
+static bool reap(Uring &ring, unsigned n, F &&on_cqe) {
+    if (ring.submit_and_wait(n) < 0) {
+        log_msg(LOG_ERR, "io_uring_enter: %m");
+        return false;
+    }
+    for (unsigned done = 0; done < n; ) {
+        io_uring_cqe *cqe = ring.peek_cqe();
+        if (!cqe) {
+            if (ring.submit_and_wait(n - done) < 0) {
+                log_msg(LOG_ERR, "io_uring_enter: %m");
+                return false;
+            }
             continue;
         }
-        fs::path dst = unique_dest_path(r.to, src.filename());
-        try {
-            fs::rename(src, dst);
-            ++moved;
-        } catch (const fs::filesystem_error &e) {
-            if (e.code().value() == EXDEV) {
-                try {
-                    fs::copy_file(src, dst, fs::copy_options::none);
-                    fs::remove(src);
-                    ++moved;
-                } catch (const fs::filesystem_error &e2) {
-                    syslog(LOG_ERR, "copy/remove failed: %s -> %s: %s", src.c_str(), dst.c_str(), e2.what());
+        uint64_t ud = cqe->user_data;
+        int res = cqe->res;
+        ring.cqe_seen();
+        on_cqe(ud, res);
+        ++done;
+    }
+    return true;
+}
+
+// Пакетный перенос: renameat(RENAME_NOREPLACE) пачками по размеру кольца,
+// затем пачками unlinkat исходников, скопированных на другое устройство.
+// Коллизии и EXDEV разбираются тем же кодом, что и в синхронном режиме.
+// Бюджет проверяется между пачками; возвращает число обработанных кандидатов.
+static size_t move_batched(Uring &ring, const Rule &r, int from_fd, const Selection &sel,
+                           DestIndex &dest, MoveStats &st, const Limiter &lim) {
+    const auto &todo = sel.items();
+    const int to_fd = dest.fd();
+    if (to_fd < 0) {
+        log_msg(LOG_ERR, "open %s: %m", r.to.c_str());
+        ++st.errors;
+        return 0;
+    }
+
+    // Скопированные на другое устройство, чьи источники ещё предстоит удалить.
+    struct Pending {
+        const char *name;
+        int journal;
+        bool done;
+    };
+    std::vector<Pending> unlink_later;
+    size_t i = 0, chunk = 0;
+    bool ok = true;
+    while (ok && i < todo.size() && !lim.exhausted(st)) {
+        if (st.commit)
+            st.commit->due();
+        chunk = i;
+        unsigned n = 0;
+        for (; i < todo.size(); ++i, ++n) {
+            io_uring_sqe *sqe = ring.get_sqe();
+            if (!sqe)
+                break;
+            if (st.throttle)
+                st.throttle->op();
+            const char *name = sel.name(todo[i]);
+            sqe->opcode = IORING_OP_RENAMEAT;
+            sqe->fd = from_fd;
+            sqe->addr = reinterpret_cast<uintptr_t>(name);
+            sqe->len = static_cast<uint32_t>(to_fd);
+            sqe->addr2 = reinterpret_cast<uintptr_t>(name);
+            sqe->rename_flags = RENAME_NOREPLACE;
+            sqe->user_data = i;
+        }
+        auto t0 = Clock::now();
+        ok = reap(ring, n, [&](uint64_t idx, int res) {
+            const char *name = sel.name(todo[idx]);
+            if (res == 0) {
+                dest.note(name);
+                ++st.moved;
+                if (st.metrics)
+                    hist_add(st.metrics->move_us, us_since(t0));
+                return;
+            }
+            if (res == -EEXIST || res == -EINVAL) {
+                // EEXIST — нужен суффикс; EINVAL — ядро/ФС без RENAMEAT или NOREPLACE
+                move_file(from_fd, name, r.from, dest, st);
+                return;
+            }
+            if (res == -ENOENT && source_gone(from_fd, name)) {
+                log_msg(LOG_DEBUG, "%s/%s is gone; skipped", r.from.c_str(), name);
+                return;
+            }
+            if (res != -EXDEV) {
+                log_msg(LOG_ERR, "rename failed: %s/%s -> %s: %s", r.from.c_str(), name, dest.dir().c_str(),
+                        std::strerror(-res));
+                ++st.errors;
+                return;
+            }
+            auto t1 = Clock::now();
+            TransferResult tr = transfer_file(from_fd, name, r.from, dest, false, st.throttle);
+            if (!tr.ok) {
+                if (!tr.suspended)
+                    ++st.errors;
+                return;
+            }
+            ++st.moved;
+            ++st.copied;
+            ++st.by_method[static_cast<size_t>(tr.method)];
+            st.bytes += tr.bytes;
+            if (st.metrics)
+                hist_add(st.metrics->move_us, us_since(t1));
+            if (st.commit) {
+                st.commit->add(from_fd, name, r.from, to_fd, std::move(tr.dst), tr.journal);
+                return;
+            }
+            state_copy_placed(tr.journal, tr.dst);
+            unlink_later.push_back(Pending{name, tr.journal, false});
+        });
+    }
+
+    for (size_t j = 0; ok && j < unlink_later.size(); ) {
+        unsigned n = 0;
+        for (; j < unlink_later.size(); ++j, ++n) {
+            io_uring_sqe *sqe = ring.get_sqe();
+            if (!sqe)
+                break;
+            sqe->opcode = IORING_OP_UNLINKAT;
+            sqe->fd = from_fd;
+            sqe->addr = reinterpret_cast<uintptr_t>(unlink_later[j].name);
+            sqe->user_data = j;
+        }
+        ok = reap(ring, n, [&](uint64_t idx, int res) {
+            Pending &p = unlink_later[idx];
+            if (res < 0 && unlinkat(from_fd, p.name, 0) != 0) {
+                ++st.errors;
+                log_msg(LOG_ERR, "transfer: remove source %s/%s: %s", r.from.c_str(), p.name, std::strerror(-res));
+            }
+            p.done = true;
+            state_copy_end(p.journal);
+        });
+    }
+
+    if (!ok) {
+        // Кольцо в неизвестном состоянии: закрываем его (ядро отменит незавершённое)
+        // и доделываем синхронно: сначала удаляем источники уже размещённых копий,
+        // иначе они уехали бы второй раз, затем — то, что ещё лежит в источнике.
+        ring.close();
+        for (Pending &p : unlink_later) {
+            if (p.done)
+                continue;
+            if (unlinkat(from_fd, p.name, 0) != 0 && errno != ENOENT) {
+                ++st.errors;
+                log_msg(LOG_ERR, "transfer: remove source %s/%s: %m", r.from.c_str(), p.name);
+            }
+            state_copy_end(p.journal);
+        }
+        if (st.commit)
+            st.commit->flush(); // источники копий из пачки тоже ещё на месте
+        for (i = chunk; i < todo.size() && !lim.exhausted(st); ++i) {
+            const char *name = sel.name(todo[i]);
+            if (faccessat(from_fd, name, F_OK, AT_SYMLINK_NOFOLLOW) == 0)
+                move_file(from_fd, name, r.from, dest, st);
+        }
+    }
+    return i;
+}
+
+// Правило, поставленное на паузу через управляющий сокет или вне своего окна
+// (window=), забирает свои файлы у правил ниже по списку, но ничего с ними не делает.
+static std::vector<char> paused_rules(const SourceGroup &g) {
+    std::vector<char> paused(g.rules.size());
+    const time_t now = time(nullptr);
+    for (size_t i = 0; i < g.rules.size(); ++i)
+        paused[i] = g.rules[i]->state->paused.load(std::memory_order_relaxed) || !g.rules[i]->window.contains(now);
+    return paused;
+}
+
+// Отметка для status управляющего сокета: источник сейчас в работе.
+class BusyScope {
+public:
+    explicit BusyScope(const SourceGroup &g) : g_(g) {
+        for (const Rule *r : g_.rules)
+            r->state->busy.store(true, std::memory_order_relaxed);
+    }
+    ~BusyScope() {
+        for (const Rule *r : g_.rules)
+            r->state->busy.store(false, std::memory_order_relaxed);
+    }
+
+private:
+    const SourceGroup &g_;
+};
+
+static bool has_tree_rules(const SourceGroup &g) {
+    for (const Rule *r : g.rules)
+        if (r->tree != TreeMode::Flat)
+            return true;
+    return false;
+}
+
+// Рекурсивный обход: задача пула — один каталог. Подкаталоги ставятся в деку
+// раньше, чем переносятся файлы, чтобы простаивающие потоки успели их украсть.
+// Бюджеты общие на всё поддерево; курсора нет — перенесённые файлы из дерева
+// уходят, и следующий тик просто начинает обход сверху.
+class TreeWalk {
+public:
+    TreeWalk(SourceGroup &g, const WorkerOptions &opt)
+        : g_(g), opt_(opt), pool_(std::max<size_t>(1, opt.tree_workers)),
+          st_(pool_.threads(), std::vector<MoveStats>(g.rules.size())),
+          share_(g.rules.size()), throttle_(new Throttle[g.rules.size()]), paused_(paused_rules(g)) {
+        for (size_t i = 0; i < g.rules.size(); ++i)
+            throttle_[i].reset(&g.rules[i]->state->bytes_rate, &g.rules[i]->state->ops_rate, opt.stop, opt.reload);
+        for (auto &row : st_)
+            for (size_t i = 0; i < row.size(); ++i) {
+                row[i].metrics = metrics_rule(g.rules[i]->slot);
+                row[i].throttle = &throttle_[i];
+            }
+        for (const Rule *r : g.rules)
+            if (r->tree != TreeMode::Flat)
+                max_depth_ = std::max(max_depth_, r->max_depth);
+    }
+
+    SourceResult run() {
+        // Корень и каталоги назначения — в посещённые: первое защищает от
+        // симлинков-петель, второе — от переноса в собственное поддерево.
+        mark_visited(g_.from);
+        for (const Rule *r : g_.rules)
+            mark_visited(r->to);
+        pool_.run([this](size_t w) { visit(fs::path(), 0, w); });
+
+        SourceResult res;
+        const double sec = std::chrono::duration<double>(Clock::now() - t0_).count();
+        for (size_t i = 0; i < g_.rules.size(); ++i) {
+            MoveStats total;
+            total.metrics = metrics_rule(g_.rules[i]->slot);
+            total.throttle = &throttle_[i];
+            for (const auto &row : st_) {
+                const MoveStats &s = row[i];
+                total.moved += s.moved;
+                total.skipped += s.skipped;
+                total.copied += s.copied;
+                total.errors += s.errors;
+                total.bytes += s.bytes;
+                total.deduped += s.deduped;
+                total.dedup_bytes += s.dedup_bytes;
+                for (size_t m = 0; m < kMethods; ++m)
+                    total.by_method[m] += s.by_method[m];
+            }
+            total.scanned = entries_.load();
+            total.scan_sec = sec;
+            total.backlog = !paused_[i] && (share_[i].cut.load() || opt_.interrupted());
+            g_.rules[i]->state->backlog.store(total.backlog, std::memory_order_relaxed);
+            res.moved += total.moved + total.deduped;
+            res.backlog = res.backlog || total.backlog;
+            flush_metrics(total);
+            log_summary("rule", *g_.rules[i], total);
+        }
+        g_.cursor = 0;
+        g_.backlog = res.backlog;
+        return res;
+    }
+
+private:
+    // Общий бюджет правила на всё поддерево.
+    struct Share {
+        std::atomic<size_t> files{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<bool> cut{false};
+    };
+
+    static fs::path under(const fs::path &base, const fs::path &rel) {
+        return rel.empty() ? base : base / rel;
+    }
+
+    bool mark_visited(const fs::path &dir) {
+        struct stat sb{};
+        if (stat(dir.c_str(), &sb) != 0)
+            return false;
+        std::lock_guard<std::mutex> lk(visited_mu_);
+        return visited_.emplace(sb.st_dev, sb.st_ino).second;
+    }
+
+    // Уровень 0 — сам from, там работают все правила; глубже — только рекурсивные.
+    bool reaches(const Rule &r, unsigned depth) const {
+        return depth == 0 || (r.tree != TreeMode::Flat && depth <= r.max_depth);
+    }
+
+    bool claim(size_t k) {
+        const Rule &r = *g_.rules[k];
+        Share &sh = share_[k];
+        if (sh.cut.load(std::memory_order_relaxed))
+            return false;
+        bool over = opt_.interrupted()
+            || (r.budget.max_files && sh.files.fetch_add(1) >= r.budget.max_files)
+            || (r.budget.max_bytes && sh.bytes.load() >= r.budget.max_bytes)
+            || (r.budget.max_ms && us_since(t0_) >= uint64_t(r.budget.max_ms) * 1000);
+        if (over)
+            sh.cut.store(true);
+        return !over;
+    }
+
+    void visit(const fs::path &rel, unsigned depth, size_t w) {
+        if (opt_.interrupted())
+            return;
+        const fs::path dir = under(g_.from, rel);
+        // Имена файлов — подряд в одной строке, каждое с завершающим нулём.
+        std::string names;
+        std::vector<uint32_t> files;
+        std::vector<std::string> dirs;
+        ScanInfo info;
+        bool ok = scan_dir_each(dir, [&](uint64_t, unsigned char type, const char *name, size_t len) {
+            if (type == DT_REG) {
+                files.push_back(static_cast<uint32_t>(names.size()));
+                names.append(name, len).push_back('\0');
+            } else if (type == DT_DIR && depth < max_depth_) {
+                dirs.emplace_back(name, len);
+            }
+        }, info);
+        if (!ok)
+            return;
+        entries_ += info.entries;
+
+        for (auto &d : dirs) {
+            fs::path sub = rel / d;
+            if (!mark_visited(g_.from / sub))
+                continue;
+            pool_.push(w, [this, sub = std::move(sub), depth](size_t w2) { visit(sub, depth + 1, w2); });
+        }
+
+        if (files.empty())
+            return;
+        DirFd from(dir);
+        if (from.get() < 0) {
+            log_msg(LOG_ERR, "open %s: %m", dir.c_str());
+            return;
+        }
+        const size_t n = g_.rules.size();
+        std::vector<std::unique_ptr<DestIndex>> dest(n);
+        std::vector<std::shared_ptr<ContentIndex>> dup(n);
+        std::vector<std::unique_ptr<CommitBatch>> commit(n); // живут не дольше from и dest
+        for (uint32_t off : files) {
+            const char *name = names.data() + off;
+            const size_t len = std::strlen(name);
+            size_t k = 0;
+            for (; k < n; ++k) {
+                const Rule &r = *g_.rules[k];
+                if (!reaches(r, depth))
+                    continue;
+                if (!is_transfer_temp(name) && r.match.matches(name, len))
+                    break;
+                ++st_[w][k].skipped;
+            }
+            if (k == n || paused_[k] || !claim(k))
+                continue;
+            const Rule &r = *g_.rules[k];
+            if (!dest[k]) {
+                fs::path to = r.tree == TreeMode::Mirror ? under(r.to, rel) : r.to;
+                std::error_code ec;
+                fs::create_directories(to, ec);
+                if (ec) {
+                    log_msg(LOG_ERR, "create %s: %s", to.c_str(), ec.message().c_str());
+                    ++st_[w][k].errors;
+                    continue;
                 }
-            } else {
-                syslog(LOG_ERR, "rename failed: %s -> %s: %s", src.c_str(), dst.c_str(), e.what());
+                dest[k] = std::make_unique<DestIndex>(to);
+                dup[k] = content_index_for(r, to);
+                if (commit_enabled())
+                    commit[k] = std::make_unique<CommitBatch>(st_[w][k].metrics);
             }
+            MoveStats &s = st_[w][k];
+            uint64_t before = s.bytes;
+            s.commit = commit[k].get();
+            deliver(r, from.get(), name, dir, *dest[k], dup[k].get(), s);
+            s.commit = nullptr;
+            share_[k].bytes += s.bytes - before;
+        }
+        for (size_t k = 0; k < n; ++k) {
+            if (commit[k]) {
+                commit[k]->flush();
+                st_[w][k].errors += commit[k]->errors();
+            }
+            if (dup[k])
+                dup[k]->save();
+        }
+    }
+
+    SourceGroup &g_;
+    const WorkerOptions &opt_;
+    WorkStealingPool pool_;
+    std::vector<std::vector<MoveStats>> st_; // [поток][правило], сводится в конце
+    std::vector<Share> share_;
+    std::unique_ptr<Throttle[]> throttle_; // по правилу, общий для потоков
+    std::vector<char> paused_;
+    unsigned max_depth_ = 0;
+    Clock::time_point t0_ = Clock::now();
+    std::atomic<size_t> entries_{0};
+    std::mutex visited_mu_;
+    std::set<std::pair<dev_t, ino_t>> visited_;
+};
+
+// Правила группы работают в одном потоке; из их классов ввода-вывода берётся
+// самый уступчивый (idle, затем be с большим номером).
+static int group_ioprio(const SourceGroup &g) {
+    int prio = -1;
+    for (const Rule *r : g.rules)
+        prio = std::max(prio, r->ioprio);
+    return prio;
+}
+
+SourceResult process_source(SourceGroup &g, const WorkerOptions &opt) {
+    const std::vector<char> paused = paused_rules(g);
+    SourceResult res;
+    if (std::all_of(paused.begin(), paused.end(), [](char p) { return p != 0; })) {
+        for (const Rule *r : g.rules)
+            r->state->backlog.store(false, std::memory_order_relaxed);
+        return res;
+    }
+    BusyScope busy(g);
+    IoprioScope io(group_ioprio(g));
+    if (has_tree_rules(g))
+        return TreeWalk(g, opt).run();
+
+    const size_t n = g.rules.size();
+    std::vector<MoveStats> st(n);
+    std::unique_ptr<Throttle[]> throttle(new Throttle[n]);
+    std::vector<Selection> sel;
+    sel.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        st[i].metrics = metrics_rule(g.rules[i]->slot);
+        throttle[i].reset(&g.rules[i]->state->bytes_rate, &g.rules[i]->state->ops_rate, opt.stop, opt.reload);
+        st[i].throttle = &throttle[i];
+        const size_t max_files = g.rules[i]->budget.max_files;
+        sel.emplace_back(max_files ? max_files : kSelectionCap);
+    }
+
+    // Один потоковый проход раскладывает файлы по правилам. Правило видит только
+    // то, что не забрали правила выше него, — как при последовательных проходах.
+    ScanInfo info;
+    bool ok = scan_dir_each(g.from, [&](uint64_t ino, unsigned char type, const char *name, size_t len) {
+        size_t k = type == DT_REG ? route(g, name, len) : n;
+        for (size_t j = 0; j < k && j < n; ++j)
+            ++st[j].skipped;
+        if (k < n && !paused[k])
+            sel[k].offer(ino - g.cursor, name, len);
+    }, info);
+    if (!ok)
+        return res;
+
+    // Ключ, с которого продолжать; max — правило разобрало всё.
+    constexpr uint64_t kDone = std::numeric_limits<uint64_t>::max();
+    uint64_t resume = kDone;
+
+    Uring *ring = opt.backend == MoveBackend::Uring ? thread_ring() : nullptr;
+    for (size_t i = 0; i < n; ++i) {
+        const Rule &r = *g.rules[i];
+        sel[i].finish();
+        const auto &todo = sel[i].items();
+        DestIndex &dest = r.state->dest;
+        dest.begin_pass();
+        for (const auto &d : r.state->fanout)
+            d->begin_pass();
+        r.state->from.refresh();
+        const int from_fd = r.state->from.get();
+        auto dup = content_index_for(r, r.to);
+        Limiter lim{r.budget, opt};
+        CommitBatch commit(st[i].metrics);
+        if (commit_enabled())
+            st[i].commit = &commit;
+        size_t done = 0;
+        if (from_fd < 0 && !todo.empty()) {
+            log_msg(LOG_ERR, "open %s: %m", r.from.c_str());
+            ++st[i].errors;
+        } else if (ring && ring->ready() && !dup && r.fanout.empty()) {
+            // с dedupe каждый файл сначала сверяется с индексом, с fanout доставок несколько —
+            // пакетный путь не годится
+            done = move_batched(*ring, r, from_fd, sel[i], dest, st[i], lim);
+        } else {
+            for (; done < todo.size() && !lim.exhausted(st[i]); ++done)
+                deliver(r, from_fd, sel[i].name(todo[done]), r.from, dest, dup.get(), st[i]);
+        }
+        commit.flush();
+        st[i].errors += commit.errors();
+        st[i].commit = nullptr;
+        if (dup)
+            dup->save();
+
+        uint64_t rule_resume = kDone;
+        if (done < todo.size())
+            rule_resume = todo[done].key;
+        else if (sel[i].overflow())
+            rule_resume = todo.back().key + 1;
+        resume = std::min(resume, rule_resume);
+
+        st[i].backlog = rule_resume != kDone;
+        r.state->backlog.store(st[i].backlog, std::memory_order_relaxed);
+        st[i].scanned = info.entries;
+        st[i].scan_sec = info.seconds;
+        res.moved += st[i].moved + st[i].deduped;
+        flush_metrics(st[i]);
+        log_summary("rule", r, st[i]);
+    }
+
+    g.backlog = resume != kDone;
+    g.cursor = g.backlog ? g.cursor + resume : 0;
+    res.backlog = g.backlog;
+    return res;
+}
+
+size_t process_entries(const SourceGroup &g, const std::vector<std::string> &names, const WorkerOptions &opt) {
+    const std::vector<char> paused = paused_rules(g);
+    BusyScope busy(g);
+    IoprioScope io(group_ioprio(g));
+    const size_t n = g.rules.size();
+    std::vector<MoveStats> st(n);
+    std::unique_ptr<Throttle[]> throttle(new Throttle[n]);
+    for (size_t i = 0; i < n; ++i) {
+        st[i].metrics = metrics_rule(g.rules[i]->slot);
+        throttle[i].reset(&g.rules[i]->state->bytes_rate, &g.rules[i]->state->ops_rate, opt.stop, opt.reload);
+        st[i].throttle = &throttle[i];
+    }
+    std::vector<std::shared_ptr<ContentIndex>> dup;
+    std::vector<std::unique_ptr<CommitBatch>> commit(n);
+    for (size_t i = 0; i < n; ++i) {
+        const Rule *r = g.rules[i];
+        r->state->dest.begin_pass();
+        for (const auto &d : r->state->fanout)
+            d->begin_pass();
+        r->state->from.refresh();
+        dup.push_back(content_index_for(*r, r->to));
+        if (commit_enabled()) {
+            commit[i] = std::make_unique<CommitBatch>(st[i].metrics);
+            st[i].commit = commit[i].get();
+        }
+    }
+    // у правил группы один from — для fstatat годится дескриптор любого из них
+    const int from_fd = g.rules.empty() ? -1 : g.rules.front()->state->from.get();
+    if (from_fd < 0)
+        return 0;
+
+    for (const auto &name : names) {
+        if (opt.interrupted())
+            break; // остаток подберёт плановый проход
+        struct stat sb{};
+        // файл мог уже уехать по предыдущему событию
+        if (fstatat(from_fd, name.c_str(), &sb, 0) != 0 || !S_ISREG(sb.st_mode))
+            continue;
+        size_t k = route(g, name.c_str(), name.size());
+        for (size_t j = 0; j < k && j < n; ++j)
+            ++st[j].skipped;
+        if (k < n && !paused[k])
+            deliver(*g.rules[k], g.rules[k]->state->from.get(), name.c_str(), g.from, g.rules[k]->state->dest,
+                    dup[k].get(), st[k]);
+    }
+    size_t moved = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (commit[i]) {
+            commit[i]->flush();
+            st[i].errors += commit[i]->errors();
         }
+        if (dup[i])
+            dup[i]->save();
+        flush_metrics(st[i]);
+        moved += st[i].moved + st[i].deduped;
+        if (st[i].moved || st[i].deduped)
+            log_summary("event", *g.rules[i], st[i]);
     }
-    syslog(LOG_INFO, "rule: from=%s to=%s ext!=%s moved=%zu skipped=%zu", r.from.c_str(), r.to.c_str(), r.ext.c_str(), moved, skipped);
-}
\ No newline at end of file
+    return moved;
+}
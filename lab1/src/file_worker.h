@@ -2,4 +2,32 @@
 
 #include "config.h"
 
-void process_rule(const Rule &r);
\ No newline at end of file
+#include <atomic>
+#include <string>
+#include <vector>
+
+enum class MoveBackend {
+    Sync,  // по одному системному вызову на операцию
+    Uring, // пакетные renameat/unlinkat через io_uring
+};
+
+struct WorkerOptions {
+    MoveBackend backend = MoveBackend::Sync;
+    size_t tree_workers = 1; // потоков на обход поддерева (recursive=...)
+    // Флаги демона: при любом из них проход останавливается между файлами.
+    const std::atomic<bool> *stop = nullptr;
+    const std::atomic<bool> *reload = nullptr;
+
+    bool interrupted() const { return (stop && *stop) || (reload && *reload); }
+};
+
+struct SourceResult {
+    size_t moved = 0;
+    bool backlog = false; // остались файлы сверх бюджета
+};
+
+// Один проход по каталогу-источнику для всех его правил; сдвигает g.cursor.
+SourceResult process_source(SourceGroup &g, const WorkerOptions &opt);
+// Обработка только перечисленных имён из g.from (событийный режим); флаги opt
+// проверяются между файлами.
+size_t process_entries(const SourceGroup &g, const std::vector<std::string> &names, const WorkerOptions &opt);
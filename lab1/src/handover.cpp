@@ -0,0 +1,250 @@
+#include "handover.h"
+#include "log.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cerrno>
+#include <cstring>
+
+static constexpr uint32_t kHandoverMagic = 0x4f48314c; // "L1HO"
+static constexpr uint32_t kHandoverVersion = 1;
+static constexpr size_t kBatch = 32; // правил в сообщении: 64 дескриптора, с запасом до SCM_MAX_FD
+
+// Первое сообщение; с ним же, если есть, дескриптор inotify.
+struct Hello {
+    uint32_t magic;
+    uint32_t version;
+    int32_t tick_sec;
+    uint32_t dirs;
+    uint32_t has_inotify;
+};
+
+struct DirsEntry {
+    uint64_t rule_key;
+    uint8_t has_from;
+    uint8_t has_to;
+};
+
+static bool fill_addr(const std::string &path, sockaddr_un &addr) {
+    if (path.size() >= sizeof(addr.sun_path)) {
+        log_msg(LOG_WARNING, "handover: socket path too long: %s", path.c_str());
+        return false;
+    }
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+int handover_listen(const std::string &path) {
+    sockaddr_un addr;
+    if (!fill_addr(path, addr))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_msg(LOG_WARNING, "handover: socket: %m");
+        return -1;
+    }
+    // сокет прежнего владельца pid-файла: тот уже вышел
+    unlink(path.c_str());
+    mode_t old_mask = umask(077);
+    int rc = bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    umask(old_mask);
+    if (rc != 0 || listen(fd, 1) != 0) {
+        log_msg(LOG_WARNING, "handover: listen %s: %m", path.c_str());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool wait_fd(int fd, short events, int timeout_ms) {
+    struct pollfd pfd{fd, events, 0};
+    for (;;) {
+        int rc = poll(&pfd, 1, timeout_ms);
+        if (rc > 0)
+            return true;
+        if (rc == 0 || errno != EINTR)
+            return false;
+    }
+}
+
+static bool send_with_fds(int sock, const void *data, size_t len, const int *fds, size_t nfds) {
+    struct iovec iov{const_cast<void *>(data), len};
+    struct msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    alignas(struct cmsghdr) char ctl[CMSG_SPACE(sizeof(int) * kBatch * 2)];
+    if (nfds) {
+        msg.msg_control = ctl;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        std::memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+    }
+    ssize_t n;
+    while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+    return n == ssize_t(len);
+}
+
+// Принятые дескрипторы дописываются в fds; у обрезанного сообщения — ошибка.
+static ssize_t recv_with_fds(int sock, void *data, size_t len, std::vector<int> &fds, int timeout_ms) {
+    if (!wait_fd(sock, POLLIN, timeout_ms)) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    struct iovec iov{data, len};
+    struct msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    alignas(struct cmsghdr) char ctl[CMSG_SPACE(sizeof(int) * kBatch * 2)];
+    msg.msg_control = ctl;
+    msg.msg_controllen = sizeof(ctl);
+    ssize_t n;
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {}
+    if (n < 0)
+        return -1;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t k = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const unsigned char *p = CMSG_DATA(cm);
+        for (size_t i = 0; i < k; ++i) {
+            int fd;
+            std::memcpy(&fd, p + i * sizeof(int), sizeof(int));
+            fds.push_back(fd);
+        }
+    }
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return n;
+}
+
+bool handover_send(int listen_fd, const Handover &h, int timeout_ms) {
+    if (!wait_fd(listen_fd, POLLIN, timeout_ms)) {
+        log_msg(LOG_WARNING, "handover: no instance connected in %d ms", timeout_ms);
+        return false;
+    }
+    int sock = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (sock < 0) {
+        log_msg(LOG_ERR, "handover: accept: %m");
+        return false;
+    }
+    struct ucred cred{};
+    socklen_t cl = sizeof(cred);
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &cl) != 0 || (cred.uid != 0 && cred.uid != geteuid())) {
+        log_msg(LOG_WARNING, "handover: peer uid %u refused", unsigned(cred.uid));
+        close(sock);
+        return false;
+    }
+
+    Hello hello{kHandoverMagic, kHandoverVersion, h.tick_sec, uint32_t(h.dirs.size()), h.inotify >= 0};
+    bool ok = send_with_fds(sock, &hello, sizeof(hello), &h.inotify, h.inotify >= 0 ? 1 : 0);
+    for (size_t i = 0; ok && i < h.dirs.size(); i += kBatch) {
+        DirsEntry batch[kBatch];
+        int fds[kBatch * 2];
+        size_t n = 0, nfds = 0;
+        for (; n < kBatch && i + n < h.dirs.size(); ++n) {
+            const HandoverDirs &d = h.dirs[i + n];
+            batch[n] = DirsEntry{d.rule_key, d.from >= 0, d.to >= 0};
+            if (d.from >= 0)
+                fds[nfds++] = d.from;
+            if (d.to >= 0)
+                fds[nfds++] = d.to;
+        }
+        ok = send_with_fds(sock, batch, n * sizeof(DirsEntry), fds, nfds);
+    }
+    if (!ok)
+        log_msg(LOG_ERR, "handover: send to pid %d: %m", int(cred.pid));
+    else
+        log_msg(LOG_INFO, "handover: state passed to pid %d (%zu rule(s)%s)", int(cred.pid), h.dirs.size(),
+                h.inotify >= 0 ? ", inotify" : "");
+    close(sock);
+    return ok;
+}
+
+int handover_connect(const std::string &path, pid_t &old) {
+    sockaddr_un addr;
+    if (!fill_addr(path, addr))
+        return -1;
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+    struct ucred cred{};
+    socklen_t cl = sizeof(cred);
+    if (connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &cl) != 0 || cred.pid <= 1) {
+        close(sock);
+        return -1;
+    }
+    old = cred.pid;
+    return sock;
+}
+
+static void close_all(std::vector<int> &fds) {
+    for (int fd : fds)
+        close(fd);
+    fds.clear();
+}
+
+bool handover_receive(int sock, Handover &h, int timeout_ms) {
+    std::vector<int> fds;
+    Hello hello{};
+    ssize_t n = recv_with_fds(sock, &hello, sizeof(hello), fds, timeout_ms);
+    if (n != ssize_t(sizeof(hello)) || hello.magic != kHandoverMagic || hello.version != kHandoverVersion ||
+        fds.size() != (hello.has_inotify ? 1u : 0u)) {
+        log_msg(LOG_WARNING, "handover: bad or missing reply: %s", n < 0 ? std::strerror(errno) : "protocol mismatch");
+        close_all(fds);
+        return false;
+    }
+    h.tick_sec = hello.tick_sec;
+    h.inotify = hello.has_inotify ? fds[0] : -1;
+    fds.clear();
+
+    while (h.dirs.size() < hello.dirs) {
+        DirsEntry batch[kBatch];
+        n = recv_with_fds(sock, batch, sizeof(batch), fds, timeout_ms);
+        size_t k = n > 0 ? size_t(n) / sizeof(DirsEntry) : 0;
+        size_t want = 0;
+        for (size_t i = 0; i < k; ++i)
+            want += batch[i].has_from + batch[i].has_to;
+        if (k == 0 || want != fds.size()) {
+            log_msg(LOG_WARNING, "handover: truncated reply after %zu rule(s)", h.dirs.size());
+            close_all(fds);
+            handover_close(h);
+            return false;
+        }
+        size_t f = 0;
+        for (size_t i = 0; i < k; ++i) {
+            HandoverDirs d;
+            d.rule_key = batch[i].rule_key;
+            d.from = batch[i].has_from ? fds[f++] : -1;
+            d.to = batch[i].has_to ? fds[f++] : -1;
+            h.dirs.push_back(d);
+        }
+        fds.clear();
+    }
+    return true;
+}
+
+void handover_close(Handover &h) {
+    if (h.inotify >= 0)
+        close(h.inotify);
+    h.inotify = -1;
+    for (HandoverDirs &d : h.dirs) {
+        if (d.from >= 0)
+            close(d.from);
+        if (d.to >= 0)
+            close(d.to);
+    }
+    h.dirs.clear();
+}
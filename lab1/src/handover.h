@@ -0,0 +1,43 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Передача дел между экземплярами демона через Unix-сокет <pid>.sock.
+// Новый экземпляр подключается к работающему и шлёт ему SIGUSR1; тот доделывает
+// начатые переносы (блочное копирование приостанавливается с отметкой в журнале
+// снимка), сохраняет снимок и отдаёт через SCM_RIGHTS открытые дескрипторы
+// каталогов правил и inotify — события, пришедшие за время передачи, не теряются.
+// Курсоры, подсказки имён и счётчики новый берёт из снимка, как после перезапуска.
+
+// Каталоги одного правила; -1 — не передаётся.
+struct HandoverDirs {
+    uint64_t rule_key = 0; // xxh64(Rule::key())
+    int from = -1;
+    int to = -1;
+};
+
+struct Handover {
+    int inotify = -1;
+    int tick_sec = 0; // период с учётом адаптации к хвосту
+    std::vector<HandoverDirs> dirs;
+};
+
+// Слушающий сокет работающего экземпляра; -1 — передача дел недоступна.
+int handover_listen(const std::string &path);
+
+// Старый экземпляр: ждёт подключения до timeout_ms и отдаёт h. Дескрипторы
+// в h остаются открытыми — закрывает их вызывающий.
+bool handover_send(int listen_fd, const Handover &h, int timeout_ms);
+
+// Новый экземпляр: подключается к работающему; old — его pid (по SO_PEERCRED).
+int handover_connect(const std::string &path, pid_t &old);
+
+// Принимает то, что отдал старый экземпляр; дескрипторы в h — уже свои (O_CLOEXEC).
+bool handover_receive(int sock, Handover &h, int timeout_ms);
+
+// Закрывает всё, что осталось в h (не подобранное новым экземпляром).
+void handover_close(Handover &h);
@@ -0,0 +1,62 @@
+#include "control.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+static int usage(const char *prog) {
+    std::fprintf(stderr,
+                 "Usage: %s [--pid /tmp/lab1d.pid | --socket <path>] [--timeout <sec>] <command>\n"
+                 "Commands: status | scan [all|<rule>] [wait] | pause <rule> | resume <rule> |\n"
+                 "          interval <sec> | workers <n> [<per_dev>] | help\n",
+                 prog);
+    return 2;
+}
+
+// Клиент управляющего сокета: bin/lab1d-ctl [--pid /tmp/lab1d.pid | --socket <path>] <команда>...
+int main(int argc, char **argv) {
+    std::string pid = "/tmp/lab1d.pid", socket_path, cmd;
+    int timeout_ms = -1;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (cmd.empty() && a == "--pid" && i + 1 < argc) {
+            pid = argv[++i];
+        }
+        else if (cmd.empty() && a == "--socket" && i + 1 < argc) {
+            socket_path = argv[++i];
+        }
+        else if (cmd.empty() && a == "--timeout" && i + 1 < argc) {
+            char *end = nullptr;
+            errno = 0;
+            long sec = std::strtol(argv[++i], &end, 10);
+            if (errno != 0 || end == argv[i] || *end != '\0' || sec <= 0 || sec > INT_MAX / 1000) {
+                std::fprintf(stderr, "%s: bad --timeout '%s'\n", argv[0], argv[i]);
+                return usage(argv[0]);
+            }
+            timeout_ms = int(sec) * 1000;
+        }
+        else {
+            if (!cmd.empty())
+                cmd += ' ';
+            cmd += a;
+        }
+    }
+    if (cmd.empty())
+        return usage(argv[0]);
+    if (socket_path.empty())
+        socket_path = pid + ".ctl";
+
+    std::string reply;
+    bool complete = control_request(socket_path, cmd, reply, timeout_ms);
+    std::fputs(reply.c_str(), stdout);
+    if (!complete) {
+        std::fprintf(stderr, "%s: no reply (is lab1d running?)\n", socket_path.c_str());
+        return 1;
+    }
+    // итоговая строка — последняя
+    size_t last = reply.rfind('\n', reply.size() - 2);
+    last = last == std::string::npos ? 0 : last + 1;
+    return reply.compare(last, 2, "ok") == 0 ? 0 : 1;
+}
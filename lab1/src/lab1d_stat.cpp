@@ -0,0 +1,175 @@
+#include "metrics.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+struct RuleView {
+    std::string from, to, filter;
+    uint64_t scanned, moved, renamed, copied, bytes, errors, deduped, dedup_bytes;
+    uint64_t scan_n, scan_p50, scan_p99, move_n, move_p50, move_p99, commit_n, commit_p50, commit_p99;
+};
+
+static uint64_t ld(const counter_t &c) {
+    return c.load(std::memory_order_relaxed);
+}
+
+// Подписи читаются под seqlock: если демон в это время перечитал конфиг, повторяем.
+static bool snapshot(const MetricsBlock &b, std::vector<RuleView> &out) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        uint64_t g1 = b.generation.load(std::memory_order_acquire);
+        if (g1 & 1) {
+            usleep(1000);
+            continue;
+        }
+        out.clear();
+        size_t n = ld(b.rule_count);
+        for (size_t i = 0; i < n && i < kMetricsRules; ++i) {
+            const RuleMetrics &m = b.rules[i];
+            RuleView v;
+            v.from.assign(m.from, strnlen(m.from, sizeof(m.from)));
+            v.to.assign(m.to, strnlen(m.to, sizeof(m.to)));
+            v.filter.assign(m.filter, strnlen(m.filter, sizeof(m.filter)));
+            v.scanned = ld(m.scanned);
+            v.moved = ld(m.moved);
+            v.renamed = ld(m.renamed);
+            v.copied = ld(m.copied);
+            v.bytes = ld(m.bytes);
+            v.errors = ld(m.errors);
+            v.deduped = ld(m.deduped);
+            v.dedup_bytes = ld(m.dedup_bytes);
+            v.scan_n = ld(m.scan_us.count);
+            v.scan_p50 = hist_quantile(m.scan_us, 0.50);
+            v.scan_p99 = hist_quantile(m.scan_us, 0.99);
+            v.move_n = ld(m.move_us.count);
+            v.move_p50 = hist_quantile(m.move_us, 0.50);
+            v.move_p99 = hist_quantile(m.move_us, 0.99);
+            v.commit_n = ld(m.commit_us.count);
+            v.commit_p50 = hist_quantile(m.commit_us, 0.50);
+            v.commit_p99 = hist_quantile(m.commit_us, 0.99);
+            if (!v.from.empty()) // слот освободился при перечитывании конфига
+                out.push_back(std::move(v));
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (b.generation.load(std::memory_order_relaxed) == g1)
+            return true;
+    }
+    return false;
+}
+
+static void json_str(const std::string &s) {
+    std::putchar('"');
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\')
+            std::printf("\\%c", c);
+        else if (c < 0x20)
+            std::printf("\\u%04x", c);
+        else
+            std::putchar(c);
+    }
+    std::putchar('"');
+}
+
+static void print_json(const MetricsBlock &b, const std::vector<RuleView> &rules) {
+    std::printf("{\"pid\":%lld,\"started\":%lld,\"ticks\":%llu,\"rules\":[",
+                (long long)b.pid, (long long)b.started, (unsigned long long)ld(b.ticks));
+    for (size_t i = 0; i < rules.size(); ++i) {
+        const RuleView &v = rules[i];
+        std::printf("%s{\"from\":", i ? "," : "");
+        json_str(v.from);
+        std::printf(",\"to\":");
+        json_str(v.to);
+        std::printf(",\"filter\":");
+        json_str(v.filter);
+        std::printf(",\"scanned\":%llu,\"moved\":%llu,\"renamed\":%llu,\"copied\":%llu,\"bytes\":%llu,\"errors\":%llu"
+                    ",\"deduped\":%llu,\"dedup_bytes\":%llu"
+                    ",\"scan_us\":{\"n\":%llu,\"p50\":%llu,\"p99\":%llu}"
+                    ",\"move_us\":{\"n\":%llu,\"p50\":%llu,\"p99\":%llu}"
+                    ",\"commit_us\":{\"n\":%llu,\"p50\":%llu,\"p99\":%llu}}",
+                    (unsigned long long)v.scanned, (unsigned long long)v.moved, (unsigned long long)v.renamed,
+                    (unsigned long long)v.copied, (unsigned long long)v.bytes, (unsigned long long)v.errors,
+                    (unsigned long long)v.deduped, (unsigned long long)v.dedup_bytes,
+                    (unsigned long long)v.scan_n, (unsigned long long)v.scan_p50, (unsigned long long)v.scan_p99,
+                    (unsigned long long)v.move_n, (unsigned long long)v.move_p50, (unsigned long long)v.move_p99,
+                    (unsigned long long)v.commit_n, (unsigned long long)v.commit_p50, (unsigned long long)v.commit_p99);
+    }
+    std::printf("]}\n");
+}
+
+static void print_text(const MetricsBlock &b, const std::vector<RuleView> &rules) {
+    std::printf("pid %lld, up %llds, ticks %llu\n", (long long)b.pid,
+                (long long)(time(nullptr) - b.started), (unsigned long long)ld(b.ticks));
+    for (const RuleView &v : rules) {
+        std::printf("%s -> %s [%s]\n", v.from.c_str(), v.to.c_str(), v.filter.c_str());
+        std::printf("  scanned=%llu moved=%llu renamed=%llu copied=%llu bytes=%llu errors=%llu\n",
+                    (unsigned long long)v.scanned, (unsigned long long)v.moved, (unsigned long long)v.renamed,
+                    (unsigned long long)v.copied, (unsigned long long)v.bytes, (unsigned long long)v.errors);
+        if (v.deduped)
+            std::printf("  deduped=%llu (%llu bytes)\n", (unsigned long long)v.deduped, (unsigned long long)v.dedup_bytes);
+        std::printf("  scan  n=%llu p50<=%lluus p99<=%lluus\n",
+                    (unsigned long long)v.scan_n, (unsigned long long)v.scan_p50, (unsigned long long)v.scan_p99);
+        std::printf("  move  n=%llu p50<=%lluus p99<=%lluus\n",
+                    (unsigned long long)v.move_n, (unsigned long long)v.move_p50, (unsigned long long)v.move_p99);
+        if (v.commit_n)
+            std::printf("  commit n=%llu p50<=%lluus p99<=%lluus\n",
+                        (unsigned long long)v.commit_n, (unsigned long long)v.commit_p50, (unsigned long long)v.commit_p99);
+    }
+}
+
+int main(int argc, char **argv) {
+    std::string tag = "lab1d", file;
+    bool json = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--json") {
+            json = true;
+        }
+        else if (a == "--tag" && i + 1 < argc) {
+            tag = argv[++i];
+        }
+        else if (a == "--file" && i + 1 < argc) {
+            file = argv[++i];
+        }
+        else {
+            std::fprintf(stderr, "Usage: %s [--tag lab1d | --file /dev/shm/lab1d.metrics] [--json]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (file.empty())
+        file = "/dev/shm/" + tag + ".metrics";
+
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::perror(file.c_str());
+        return 1;
+    }
+    void *p = mmap(nullptr, sizeof(MetricsBlock), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        std::perror("mmap");
+        return 1;
+    }
+    const auto *b = static_cast<const MetricsBlock *>(p);
+    if (__atomic_load_n(&b->magic, __ATOMIC_ACQUIRE) != kMetricsMagic || b->version != kMetricsVersion) {
+        std::fprintf(stderr, "%s: not a lab1d metrics block (or version mismatch)\n", file.c_str());
+        return 1;
+    }
+
+    std::vector<RuleView> rules;
+    if (!snapshot(*b, rules)) {
+        std::fprintf(stderr, "%s: daemon keeps reloading, try again\n", file.c_str());
+        return 1;
+    }
+    if (json)
+        print_json(*b, rules);
+    else
+        print_text(*b, rules);
+    munmap(p, sizeof(MetricsBlock));
+    return 0;
+}
@@ -0,0 +1,389 @@
+#include "log.h"
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+
+static constexpr size_t kMsgMax = 480;
+static constexpr size_t kRingSlots = 4096; // ~2 МиБ — потолок памяти журнала
+static constexpr unsigned kLogBurst = 10;
+static constexpr size_t kLimitSlots = 256;
+static constexpr size_t kBatchBytes = 64 * 1024;
+
+// Ограниченная очередь Вьюкова: производители занимают слот CAS-ом по head,
+// готовность слота публикуется его seq; потребитель один — фоновый поток.
+struct Slot {
+    std::atomic<size_t> seq;
+    int prio;
+    uint16_t len;
+    char text[kMsgMax];
+};
+
+struct Limit {
+    std::atomic<const char *> fmt{nullptr};
+    std::atomic<int64_t> second{0};
+    std::atomic<unsigned> count{0};
+    std::atomic<unsigned> suppressed{0};
+};
+
+namespace {
+
+struct LogState {
+    Slot ring[kRingSlots];
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) size_t tail = 0;
+
+    Limit limits[kLimitSlots];
+    std::atomic<uint64_t> written{0}, suppressed{0}, dropped{0};
+    std::atomic<uint64_t> dropped_unreported{0};
+
+    std::atomic<bool> running{false};
+    std::atomic<bool> quit{false};
+    std::thread writer;
+    // Писатель, которому нечего делать, выставляет sleeping и ждёт wake_fd;
+    // будит его только тот производитель, что застал флаг, — один write на простой.
+    std::atomic<bool> sleeping{false};
+    int wake_fd = -1;
+
+    std::mutex sink_mu; // только для смены приёмника
+    std::string sink, pending_sink, tag;
+    std::atomic<bool> sink_changed{false};
+    int fd = -1;
+
+    LogState() { reset_ring(); }
+
+    void reset_ring() {
+        for (size_t i = 0; i < kRingSlots; ++i)
+            ring[i].seq.store(i, std::memory_order_relaxed);
+        head.store(0, std::memory_order_relaxed);
+        tail = 0;
+    }
+};
+
+LogState &state() {
+    static LogState *s = new LogState; // не разрушается: журналируют и из деструкторов
+    return *s;
+}
+
+} // namespace
+
+static int64_t coarse_sec() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+static void wake_writer() {
+    LogState &s = state();
+    std::atomic_thread_fence(std::memory_order_seq_cst); // парная — в writer_loop
+    if (s.sleeping.load(std::memory_order_relaxed) && s.sleeping.exchange(false) && s.wake_fd >= 0)
+        eventfd_write(s.wake_fd, 1);
+}
+
+static bool enqueue(int prio, const char *fmt, va_list ap) {
+    LogState &s = state();
+    size_t pos = s.head.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+        slot = &s.ring[pos % kRingSlots];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        intptr_t dif = intptr_t(seq) - intptr_t(pos);
+        if (dif == 0) {
+            if (s.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return false; // полно
+        } else {
+            pos = s.head.load(std::memory_order_relaxed);
+        }
+    }
+    int n = std::vsnprintf(slot->text, kMsgMax, fmt, ap);
+    slot->prio = prio;
+    slot->len = static_cast<uint16_t>(n < 0 ? 0 : std::min<size_t>(size_t(n), kMsgMax - 1));
+    slot->seq.store(pos + 1, std::memory_order_release);
+    wake_writer();
+    return true;
+}
+
+static void enqueue_note(int prio, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void enqueue_note(int prio, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    bool ok = enqueue(prio, fmt, ap);
+    va_end(ap);
+    if (!ok) {
+        state().dropped.fetch_add(1, std::memory_order_relaxed);
+        state().dropped_unreported.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Лимит по адресу строки формата: "похожие" — напечатанные одним и тем же местом кода.
+// Только err и серьёзнее, warning: итоги правил печатаются одним форматом на все
+// правила, и после kLogBurst правил за секунду пропадали бы.
+// Гонки между потоками лишь немного сдвигают счёт, блокировок нет.
+static bool admit(int prio, const char *fmt) {
+    if (LOG_PRI(prio) > LOG_WARNING)
+        return true;
+    LogState &s = state();
+    Limit &l = s.limits[(reinterpret_cast<uintptr_t>(fmt) >> 3) % kLimitSlots];
+    if (l.fmt.load(std::memory_order_relaxed) != fmt) {
+        l.fmt.store(fmt, std::memory_order_relaxed);
+        l.count.store(0, std::memory_order_relaxed);
+        l.suppressed.store(0, std::memory_order_relaxed);
+    }
+    int64_t now = coarse_sec();
+    int64_t was = l.second.load(std::memory_order_relaxed);
+    if (was != now && l.second.compare_exchange_strong(was, now, std::memory_order_relaxed)) {
+        l.count.store(0, std::memory_order_relaxed);
+        if (unsigned n = l.suppressed.exchange(0, std::memory_order_relaxed))
+            enqueue_note(LOG_NOTICE, "%u similar messages suppressed: %.80s", n, fmt);
+    }
+    if (l.count.fetch_add(1, std::memory_order_relaxed) < kLogBurst)
+        return true;
+    // первое подавленное в окне: писатель должен проснуться, чтобы свести их по таймеру
+    if (l.suppressed.fetch_add(1, std::memory_order_relaxed) == 0)
+        wake_writer();
+    s.suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void log_msg(int prio, const char *fmt, ...) {
+    LogState &s = state();
+    int saved = errno; // для %m
+    va_list ap;
+    va_start(ap, fmt);
+    if (!s.running.load(std::memory_order_acquire)) {
+        errno = saved;
+        vsyslog(prio, fmt, ap);
+        va_end(ap);
+        return;
+    }
+    if (admit(prio, fmt)) {
+        errno = saved;
+        if (!enqueue(prio, fmt, ap)) {
+            s.dropped.fetch_add(1, std::memory_order_relaxed);
+            s.dropped_unreported.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    va_end(ap);
+    errno = saved;
+}
+
+static const char *prio_name(int prio) {
+    static const char *names[] = {"emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"};
+    return names[LOG_PRI(prio)];
+}
+
+static void open_sink(LogState &s) {
+    if (s.fd >= 0)
+        close(s.fd);
+    s.fd = -1;
+    if (s.sink.empty() || s.sink == "syslog")
+        return;
+    s.fd = open(s.sink.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (s.fd < 0)
+        syslog(LOG_ERR, "log file %s: %m; using syslog", s.sink.c_str());
+}
+
+// Файл: сообщения пачки собираются в один буфер и пишутся одним write().
+static void flush_batch(LogState &s, std::string &batch) {
+    if (batch.empty())
+        return;
+    for (size_t off = 0; off < batch.size(); ) {
+        ssize_t n = write(s.fd, batch.data() + off, batch.size() - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        off += size_t(n);
+    }
+    batch.clear();
+}
+
+static void emit(LogState &s, int prio, const char *text, size_t len, std::string &batch) {
+    s.written.fetch_add(1, std::memory_order_relaxed);
+    if (s.fd < 0) {
+        syslog(prio, "%.*s", int(len), text);
+        return;
+    }
+    char head[96];
+    time_t now = time(nullptr);
+    struct tm tm{};
+    localtime_r(&now, &tm);
+    size_t h = strftime(head, sizeof(head), "%Y-%m-%dT%H:%M:%S ", &tm);
+    h += std::snprintf(head + h, sizeof(head) - h, "%s[%d] %s: ", s.tag.c_str(), int(getpid()), prio_name(prio));
+    batch.append(head, std::min(h, sizeof(head) - 1)).append(text, len).push_back('\n');
+    if (batch.size() >= kBatchBytes)
+        flush_batch(s, batch);
+}
+
+static bool ready(LogState &s) {
+    return s.ring[s.tail % kRingSlots].seq.load(std::memory_order_acquire) == s.tail + 1;
+}
+
+static bool any_suppressed(LogState &s) {
+    for (const Limit &l : s.limits)
+        if (l.suppressed.load(std::memory_order_relaxed))
+            return true;
+    return false;
+}
+
+// Забирает всё готовое; false — кольцо было пусто.
+static bool drain(LogState &s, std::string &batch) {
+    bool any = false;
+    for (;;) {
+        Slot &slot = s.ring[s.tail % kRingSlots];
+        if (slot.seq.load(std::memory_order_acquire) != s.tail + 1)
+            break;
+        emit(s, slot.prio, slot.text, slot.len, batch);
+        slot.seq.store(s.tail + kRingSlots, std::memory_order_release);
+        ++s.tail;
+        any = true;
+    }
+    if (uint64_t n = s.dropped_unreported.exchange(0, std::memory_order_relaxed)) {
+        char note[96];
+        int len = std::snprintf(note, sizeof(note), "%llu log messages dropped: buffer full", (unsigned long long)n);
+        emit(s, LOG_WARNING, note, size_t(len), batch);
+    }
+    flush_batch(s, batch);
+    return any;
+}
+
+// Сводки по окнам, которые уже закрылись, но не дождались следующего сообщения
+// своего вида (или все — при остановке).
+static void report_suppressed(LogState &s, std::string &batch, bool all) {
+    int64_t now = coarse_sec();
+    for (Limit &l : s.limits) {
+        if (l.suppressed.load(std::memory_order_relaxed) == 0)
+            continue;
+        if (!all && l.second.load(std::memory_order_relaxed) == now)
+            continue;
+        unsigned n = l.suppressed.exchange(0, std::memory_order_relaxed);
+        const char *fmt = l.fmt.load(std::memory_order_relaxed);
+        if (!n || !fmt)
+            continue;
+        char note[160];
+        int len = std::snprintf(note, sizeof(note), "%u similar messages suppressed: %.80s", n, fmt);
+        emit(s, LOG_NOTICE, note, std::min(size_t(len), sizeof(note) - 1), batch);
+    }
+    flush_batch(s, batch);
+}
+
+static void writer_loop() {
+    LogState &s = state();
+    std::string batch;
+    batch.reserve(kBatchBytes);
+    int64_t swept = coarse_sec();
+    while (!s.quit.load(std::memory_order_acquire)) {
+        if (coarse_sec() != swept) {
+            swept = coarse_sec();
+            report_suppressed(s, batch, false);
+        }
+        if (s.sink_changed.exchange(false)) {
+            std::lock_guard<std::mutex> lk(s.sink_mu);
+            s.sink = s.pending_sink;
+            open_sink(s);
+        }
+        if (drain(s, batch))
+            continue;
+        // Пусто — спим до записи в кольцо; производители никогда не ждут писателя.
+        // Флаг ставится до последней проверки кольца, так что запись между ними не
+        // теряется: её автор увидит флаг и разбудит. Подавленные сообщения сводятся
+        // раз в секунду — пока они есть, сон ограничен.
+        s.sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready(s) && !s.quit.load() && !s.sink_changed.load()) {
+            struct pollfd pfd{s.wake_fd, POLLIN, 0};
+            poll(&pfd, 1, any_suppressed(s) ? 1000 : -1);
+        }
+        s.sleeping.store(false);
+        eventfd_t v;
+        eventfd_read(s.wake_fd, &v);
+    }
+    drain(s, batch);
+    report_suppressed(s, batch, true);
+}
+
+void log_start(const std::string &tag, const std::string &sink) {
+    LogState &s = state();
+    if (s.running.load())
+        return;
+    s.tag = tag;
+    s.sink = sink;
+    open_sink(s);
+    if (s.wake_fd < 0)
+        s.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    s.quit.store(false);
+    s.writer = std::thread(writer_loop);
+    s.running.store(true, std::memory_order_release);
+}
+
+void log_reopen(const std::string &sink) {
+    LogState &s = state();
+    if (!s.running.load()) {
+        s.sink = sink;
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(s.sink_mu);
+        s.pending_sink = sink;
+        s.sink_changed.store(true);
+    }
+    if (s.wake_fd >= 0)
+        eventfd_write(s.wake_fd, 1);
+}
+
+void log_stop() {
+    LogState &s = state();
+    if (!s.running.exchange(false))
+        return;
+    s.quit.store(true, std::memory_order_release);
+    if (s.wake_fd >= 0)
+        eventfd_write(s.wake_fd, 1);
+    if (s.writer.joinable())
+        s.writer.join();
+    if (s.fd >= 0)
+        close(s.fd);
+    s.fd = -1;
+    if (s.wake_fd >= 0)
+        close(s.wake_fd);
+    s.wake_fd = -1;
+}
+
+void log_after_fork() {
+    LogState &s = state();
+    if (!s.running.exchange(false))
+        return;
+    // Объект потока и мьютекс скопированы в том виде, в каком их застал fork():
+    // поток здесь не существует, мьютекс мог быть захвачен. Без деструкторов
+    // заводим новые на их месте.
+    new (&s.writer) std::thread();
+    new (&s.sink_mu) std::mutex();
+    // eventfd общий с родителем — свой заведёт log_start
+    if (s.wake_fd >= 0)
+        close(s.wake_fd);
+    s.wake_fd = -1;
+    s.sleeping.store(false);
+    s.reset_ring();
+    if (s.sink_changed.exchange(false))
+        s.sink = s.pending_sink;
+    std::string tag = s.tag, sink = s.sink;
+    log_start(tag, sink);
+}
+
+LogStats log_stats() {
+    LogState &s = state();
+    return LogStats{s.written.load(), s.suppressed.load(), s.dropped.load()};
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <syslog.h>
+
+#include <cstdint>
+#include <string>
+
+// Асинхронный журнал. log_msg() форматирует сообщение в слот lock-free кольца
+// и сразу возвращается; запись в syslog или файл делает фоновый поток пачками.
+// Пока поток не запущен (до daemonize) и после log_stop() сообщения уходят в
+// syslog синхронно, так что openlog/closelog вокруг daemonize работают как раньше.
+//
+// Одинаковые ошибки и предупреждения (один и тот же формат) ограничиваются
+// kLogBurst в секунду, остальные считаются и сводятся в "N similar messages
+// suppressed"; notice, info и debug — итоги правил и прочее — не ограничиваются.
+// Если кольцо полно, сообщение выбрасывается и тоже учитывается — ожидания нет
+// никогда. Поток-писатель спит на eventfd, пока кольцо пусто.
+void log_msg(int prio, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// sink: "syslog" или путь к файлу (дописывается, переоткрывается по log_reopen()).
+void log_start(const std::string &tag, const std::string &sink);
+void log_reopen(const std::string &sink);
+// Дописывает всё накопленное и останавливает поток.
+void log_stop();
+// В дочернем процессе сразу после fork(): писателя родителя там нет, поэтому
+// кольцо начинается заново (недописанное допишет родитель) со своим потоком.
+void log_after_fork();
+
+struct LogStats {
+    uint64_t written;
+    uint64_t suppressed;
+    uint64_t dropped;
+};
+LogStats log_stats();
@@ -0,0 +1,130 @@
+#include "matcher.h"
+#include "utils.h"
+
+#include <fnmatch.h>
+
+#include <cctype>
+
+static uint32_t hash_lower(const char *p, size_t len) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; ++i) {
+        h ^= static_cast<uint32_t>(std::tolower(static_cast<unsigned char>(p[i])));
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void ExtSet::rehash(size_t cap) {
+    std::vector<Slot> old;
+    old.swap(slots_);
+    slots_.assign(cap, Slot{});
+    for (const Slot &s : old) {
+        if (!s.used)
+            continue;
+        size_t i = s.hash & (cap - 1);
+        while (slots_[i].used)
+            i = (i + 1) & (cap - 1);
+        slots_[i] = s;
+    }
+}
+
+void ExtSet::add(const std::string &ext_lower) {
+    if (contains(ext_lower.data(), ext_lower.size()))
+        return;
+    if ((count_ + 1) * 2 > slots_.size())
+        rehash(slots_.empty() ? 8 : slots_.size() * 2);
+
+    Slot s;
+    s.hash = hash_lower(ext_lower.data(), ext_lower.size());
+    s.off = static_cast<uint32_t>(arena_.size());
+    s.len = static_cast<uint32_t>(ext_lower.size());
+    s.used = true;
+    arena_ += ext_lower;
+
+    size_t mask = slots_.size() - 1;
+    size_t i = s.hash & mask;
+    while (slots_[i].used)
+        i = (i + 1) & mask;
+    slots_[i] = s;
+    ++count_;
+}
+
+bool ExtSet::contains(const char *ext, size_t len) const {
+    if (count_ == 0)
+        return false;
+    uint32_t h = hash_lower(ext, len);
+    size_t mask = slots_.size() - 1;
+    for (size_t i = h & mask; slots_[i].used; i = (i + 1) & mask) {
+        const Slot &s = slots_[i];
+        if (s.hash != h || s.len != len)
+            continue;
+        size_t k = 0;
+        while (k < len && std::tolower(static_cast<unsigned char>(ext[k])) == static_cast<unsigned char>(arena_[s.off + k]))
+            ++k;
+        if (k == len)
+            return true;
+    }
+    return false;
+}
+
+static bool is_glob(const std::string &s) {
+    return s.find_first_of("*?[") != std::string::npos;
+}
+
+bool Matcher::compile(const std::string &spec, std::string &err) {
+    size_t start = 0;
+    bool any = false;
+    while (start <= spec.size()) {
+        size_t comma = spec.find(',', start);
+        std::string tok = spec.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        start = comma == std::string::npos ? spec.size() + 1 : comma + 1;
+        if (tok.empty())
+            continue;
+
+        bool include = false;
+        if (tok.front() == '+' || tok.front() == '-') {
+            include = tok.front() == '+';
+            tok.erase(0, 1);
+        }
+        if (is_glob(tok)) {
+            (include ? include_glob_ : exclude_glob_).push_back(tok);
+            any = true;
+            continue;
+        }
+        if (!tok.empty() && tok.front() == '.')
+            tok.erase(0, 1);
+        if (tok.empty()) {
+            err = "empty extension";
+            return false;
+        }
+        (include ? include_ext_ : exclude_ext_).add(to_lower(tok));
+        any = true;
+    }
+    if (!any) {
+        err = "empty extension";
+        return false;
+    }
+    return true;
+}
+
+static bool glob_any(const std::vector<std::string> &globs, const char *name) {
+    for (const auto &g : globs) {
+        if (fnmatch(g.c_str(), name, FNM_CASEFOLD | FNM_PERIOD) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool Matcher::matches(const char *name, size_t len) const {
+    const char *ext = nullptr;
+    size_t ext_len = 0;
+    if (ext_of(name, len, ext, ext_len) && exclude_ext_.contains(ext, ext_len))
+        return false;
+    if (!exclude_glob_.empty() && glob_any(exclude_glob_, name))
+        return false;
+    if (include_ext_.empty() && include_glob_.empty())
+        return true;
+    if (ext && include_ext_.contains(ext, ext_len))
+        return true;
+    return glob_any(include_glob_, name);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Набор расширений с открытой адресацией: хеш считается по байтам имени
+// с приведением к нижнему регистру на лету, без выделения памяти.
+class ExtSet {
+public:
+    void add(const std::string &ext_lower);
+    bool contains(const char *ext, size_t len) const;
+    bool empty() const { return count_ == 0; }
+
+private:
+    struct Slot {
+        uint32_t hash = 0;
+        uint32_t off = 0;
+        uint32_t len = 0;
+        bool used = false;
+    };
+    void rehash(size_t cap);
+
+    std::vector<Slot> slots_;
+    std::string arena_;
+    size_t count_ = 0;
+};
+
+// Скомпилированный фильтр правила. Элементы списка через запятую:
+//   jpg, .jpg, -jpg   — не перемещать файлы с этим расширением;
+//   -*.tmp, *.part    — не перемещать файлы, подходящие под glob;
+//   +png, +report_*   — перемещать только подходящие (если задан хоть один '+').
+// Сравнение без учёта регистра.
+class Matcher {
+public:
+    // false и текст ошибки в err, если элемент некорректен.
+    bool compile(const std::string &spec, std::string &err);
+    // true — файл должен быть перемещён по этому правилу.
+    bool matches(const char *name, size_t len) const;
+
+private:
+    ExtSet exclude_ext_;
+    ExtSet include_ext_;
+    std::vector<std::string> exclude_glob_;
+    std::vector<std::string> include_glob_;
+};
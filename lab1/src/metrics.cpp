@@ -0,0 +1,119 @@
+#include "metrics.h"
+#include "log.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cstring>
+#include <ctime>
+
+static MetricsBlock *g_block = nullptr;
+static std::string g_path;
+
+bool metrics_open(const std::string &path) {
+    metrics_close();
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_msg(LOG_WARNING, "metrics: open %s: %m", path.c_str());
+        return false;
+    }
+    if (ftruncate(fd, sizeof(MetricsBlock)) != 0) {
+        log_msg(LOG_WARNING, "metrics: ftruncate %s: %m", path.c_str());
+        close(fd);
+        return false;
+    }
+    void *p = mmap(nullptr, sizeof(MetricsBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        log_msg(LOG_WARNING, "metrics: mmap %s: %m", path.c_str());
+        return false;
+    }
+
+    // Блок от прошлого запуска не продолжаем: счётчики считаются с момента старта.
+    std::memset(p, 0, sizeof(MetricsBlock));
+    g_block = static_cast<MetricsBlock *>(p);
+    g_block->version = kMetricsVersion;
+    g_block->pid = getpid();
+    g_block->started = time(nullptr);
+    __atomic_store_n(&g_block->magic, kMetricsMagic, __ATOMIC_RELEASE);
+    g_path = path;
+    return true;
+}
+
+void metrics_close() {
+    if (!g_block)
+        return;
+    munmap(g_block, sizeof(MetricsBlock));
+    unlink(g_path.c_str());
+    g_block = nullptr;
+    g_path.clear();
+}
+
+MetricsBlock *metrics_block() {
+    return g_block;
+}
+
+RuleMetrics *metrics_rule(int slot) {
+    if (!g_block || slot < 0 || static_cast<size_t>(slot) >= kMetricsRules)
+        return nullptr;
+    return &g_block->rules[slot];
+}
+
+void metrics_begin_update() {
+    if (g_block)
+        g_block->generation.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void metrics_end_update(size_t rule_count) {
+    if (!g_block)
+        return;
+    g_block->rule_count.store(rule_count < kMetricsRules ? rule_count : kMetricsRules, std::memory_order_relaxed);
+    g_block->generation.fetch_add(1, std::memory_order_acq_rel);
+}
+
+static void copy_label(char *dst, size_t cap, const std::string &s) {
+    std::strncpy(dst, s.c_str(), cap - 1);
+    dst[cap - 1] = '\0';
+}
+
+void metrics_assign(int slot, const std::string &from, const std::string &to, const std::string &filter) {
+    RuleMetrics *m = metrics_rule(slot);
+    if (!m)
+        return;
+    std::memset(static_cast<void *>(m), 0, sizeof(*m));
+    copy_label(m->from, sizeof(m->from), from);
+    copy_label(m->to, sizeof(m->to), to);
+    copy_label(m->filter, sizeof(m->filter), filter);
+}
+
+void hist_add(Histogram &h, uint64_t us) {
+    size_t b = 0;
+    while (b + 1 < kHistBuckets && (us >> (b + 1)) != 0)
+        ++b;
+    bump(h.buckets[b]);
+    bump(h.count);
+    bump(h.sum_us, us);
+}
+
+uint64_t hist_quantile(const Histogram &h, double q) {
+    uint64_t total = 0;
+    uint64_t counts[kHistBuckets];
+    for (size_t i = 0; i < kHistBuckets; ++i) {
+        counts[i] = h.buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0)
+        return 0;
+    uint64_t need = static_cast<uint64_t>(q * total);
+    if (need == 0)
+        need = 1;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < kHistBuckets; ++i) {
+        acc += counts[i];
+        if (acc >= need)
+            return uint64_t(2) << i;
+    }
+    return uint64_t(2) << (kHistBuckets - 1);
+}
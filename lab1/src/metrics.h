@@ -0,0 +1,74 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Блок метрик в разделяемой памяти (/dev/shm). Демон только увеличивает
+// атомарные счётчики, lab1d-stat читает тот же файл без сигналов и блокировок.
+// Раскладка фиксирована и проверяется по magic/version.
+
+static constexpr uint32_t kMetricsMagic = 0x4d443131; // "11DM"
+static constexpr uint32_t kMetricsVersion = 3;
+static constexpr size_t kMetricsRules = 256;
+static constexpr size_t kHistBuckets = 32; // корзина i: [2^i, 2^(i+1)) мкс
+
+using counter_t = std::atomic<uint64_t>;
+static_assert(counter_t::is_always_lock_free, "metrics need lock-free 64-bit atomics");
+
+struct Histogram {
+    counter_t buckets[kHistBuckets];
+    counter_t count;
+    counter_t sum_us;
+};
+
+struct RuleMetrics {
+    char from[160];
+    char to[160];
+    char filter[64];
+    counter_t scanned;
+    counter_t moved;
+    counter_t renamed; // тем же устройством, одним rename
+    counter_t copied;  // через межустройственный перенос
+    counter_t bytes;   // скопировано байт
+    counter_t errors;
+    counter_t deduped;     // источник совпал по содержимому с файлом в назначении
+    counter_t dedup_bytes; // сколько байт не пришлось переносить
+    Histogram scan_us;
+    Histogram move_us;
+    Histogram commit_us; // групповая фиксация (durability): сброс пачки и удаление источников
+};
+
+struct MetricsBlock {
+    uint32_t magic;
+    uint32_t version;
+    // Нечётное значение — демон переписывает подписи правил (перечитан конфиг).
+    counter_t generation;
+    counter_t rule_count;
+    counter_t ticks;
+    int64_t pid;
+    int64_t started; // unix time
+    RuleMetrics rules[kMetricsRules];
+};
+
+bool metrics_open(const std::string &path);
+void metrics_close();
+MetricsBlock *metrics_block();
+// nullptr, если метрики выключены или слот вне блока.
+RuleMetrics *metrics_rule(int slot);
+
+void metrics_begin_update();
+void metrics_end_update(size_t rule_count);
+// Назначает слот правилу: подписи и обнуление счётчиков, между begin/end_update.
+void metrics_assign(int slot, const std::string &from, const std::string &to, const std::string &filter);
+
+void hist_add(Histogram &h, uint64_t us);
+// Верхняя граница корзины, в которую попадает квантиль q; 0 — данных нет.
+uint64_t hist_quantile(const Histogram &h, double q);
+
+inline void bump(counter_t &c, uint64_t v = 1) {
+    c.fetch_add(v, std::memory_order_relaxed);
+}
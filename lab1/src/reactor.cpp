@@ -0,0 +1,212 @@
+#include "reactor.h"
+#include "log.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <new>
+#include <vector>
+
+Reactor::~Reactor() {
+    close();
+}
+
+bool Reactor::open() {
+    close();
+    ep_ = epoll_create1(EPOLL_CLOEXEC);
+    if (ep_ < 0)
+        log_msg(LOG_ERR, "epoll_create1: %m");
+    return ep_ >= 0;
+}
+
+void Reactor::close() {
+    if (ep_ >= 0)
+        ::close(ep_);
+    ep_ = -1;
+    handlers_.clear();
+}
+
+void Reactor::after_fork() {
+    close();
+}
+
+bool Reactor::add(int fd, uint32_t events, Handler fn) {
+    struct epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (fd < 0 || epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        log_msg(LOG_ERR, "epoll_ctl add %d: %m", fd);
+        return false;
+    }
+    handlers_[fd] = std::move(fn);
+    return true;
+}
+
+bool Reactor::modify(int fd, uint32_t events) {
+    struct epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(ep_, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void Reactor::remove(int fd) {
+    if (handlers_.erase(fd))
+        epoll_ctl(ep_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int Reactor::run_once(int timeout_ms) {
+    struct epoll_event evs[16];
+    int n = epoll_wait(ep_, evs, 16, timeout_ms);
+    if (n < 0) {
+        if (errno != EINTR)
+            log_msg(LOG_ERR, "epoll_wait: %m");
+        return 0;
+    }
+    for (int i = 0; i < n; ++i) {
+        // обработчик предыдущего события мог снять этот дескриптор
+        auto it = handlers_.find(evs[i].data.fd);
+        if (it == handlers_.end())
+            continue;
+        Handler fn = it->second; // копия: обработчик может перерегистрироваться
+        fn(evs[i].events);
+    }
+    return n;
+}
+
+void block_signals(const sigset_t &set) {
+    if (sigprocmask(SIG_BLOCK, &set, nullptr) != 0)
+        log_msg(LOG_ERR, "sigprocmask: %m");
+}
+
+int open_signalfd(const sigset_t &set) {
+    int fd = signalfd(-1, &set, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (fd < 0)
+        log_msg(LOG_ERR, "signalfd: %m");
+    return fd;
+}
+
+int read_signal(int fd) {
+    struct signalfd_siginfo si;
+    ssize_t n;
+    while ((n = read(fd, &si, sizeof(si))) < 0 && errno == EINTR) {}
+    return n == ssize_t(sizeof(si)) ? int(si.ssi_signo) : 0;
+}
+
+int open_timer() {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0)
+        log_msg(LOG_ERR, "timerfd_create: %m");
+    return fd;
+}
+
+static struct timespec to_timespec(int64_t ms) {
+    struct timespec ts{};
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    return ts;
+}
+
+void arm_timer(int fd, int64_t after_ms, int64_t period_ms) {
+    struct itimerspec its{};
+    its.it_value = to_timespec(after_ms);
+    its.it_interval = to_timespec(period_ms);
+    // нулевой it_value выключает таймер — "сейчас" означает через 1 нс
+    if (after_ms <= 0 && period_ms > 0)
+        its.it_value.tv_nsec = 1;
+    if (timerfd_settime(fd, 0, &its, nullptr) != 0)
+        log_msg(LOG_ERR, "timerfd_settime: %m");
+}
+
+uint64_t read_timer(int fd) {
+    uint64_t n = 0;
+    if (read(fd, &n, sizeof(n)) != ssize_t(sizeof(n)))
+        return 0;
+    return n;
+}
+
+Offload::~Offload() {
+    stop();
+}
+
+bool Offload::start() {
+    stop();
+    done_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (done_fd_ < 0) {
+        log_msg(LOG_ERR, "eventfd: %m");
+        return false;
+    }
+    quit_ = ready_ = busy_ = false;
+    thread_ = std::thread(&Offload::loop, this);
+    return true;
+}
+
+void Offload::stop() {
+    if (done_fd_ < 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        quit_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+    ::close(done_fd_);
+    done_fd_ = -1;
+    busy_ = false;
+    done_ = nullptr;
+}
+
+void Offload::after_fork() {
+    if (done_fd_ < 0)
+        return;
+    ::close(done_fd_);
+    done_fd_ = -1;
+    // как в log_after_fork: потока здесь нет, мьютекс мог быть захвачен
+    new (&thread_) std::thread();
+    new (&mu_) std::mutex();
+    new (&cv_) std::condition_variable();
+    busy_ = ready_ = false;
+    job_ = done_ = nullptr;
+}
+
+void Offload::post(std::function<void()> job, std::function<void()> done) {
+    busy_ = true;
+    done_ = std::move(done);
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        job_ = std::move(job);
+        ready_ = true;
+    }
+    cv_.notify_all();
+}
+
+void Offload::complete() {
+    uint64_t v;
+    if (read(done_fd_, &v, sizeof(v)) != ssize_t(sizeof(v)))
+        return;
+    busy_ = false;
+    std::function<void()> done = std::move(done_);
+    done_ = nullptr;
+    if (done)
+        done();
+}
+
+void Offload::loop() {
+    std::unique_lock<std::mutex> lk(mu_);
+    for (;;) {
+        cv_.wait(lk, [this] { return quit_ || ready_; });
+        if (!ready_)
+            return;
+        std::function<void()> job = std::move(job_);
+        ready_ = false;
+        lk.unlock();
+        job();
+        lk.lock();
+        uint64_t one = 1;
+        if (write(done_fd_, &one, sizeof(one)) < 0)
+            log_msg(LOG_ERR, "offload: eventfd write: %m");
+    }
+}
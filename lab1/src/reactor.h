@@ -0,0 +1,91 @@
+#pragma once
+
+#include <signal.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// Главный цикл демона на epoll: сигналы (signalfd), таймер тиков (timerfd),
+// inotify, пробуждения от управляющего сокета и завершение прохода — всё это
+// источники событий с обработчиками. Обработчики вызываются в потоке,
+// крутящем run_once(), и не должны блокироваться.
+class Reactor {
+public:
+    using Handler = std::function<void(uint32_t events)>;
+
+    Reactor() = default;
+    ~Reactor();
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+
+    bool open();
+    void close();
+    // В дочернем процессе после fork(): экземпляр epoll общий с родителем —
+    // отпустить его, не трогая регистраций.
+    void after_fork();
+
+    bool add(int fd, uint32_t events, Handler fn);
+    // 0 — временно не слушать (дескриптор остаётся зарегистрированным).
+    bool modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    // Ждёт до timeout_ms (-1 — без ограничения) и вызывает обработчики готовых
+    // дескрипторов; возвращает их число, 0 — таймаут или сигнал.
+    int run_once(int timeout_ms);
+
+private:
+    int ep_ = -1;
+    std::unordered_map<int, Handler> handlers_;
+};
+
+// signalfd на set; сами сигналы должны быть заблокированы во всех потоках
+// (block_signals до создания первого потока).
+int open_signalfd(const sigset_t &set);
+void block_signals(const sigset_t &set);
+// Номер следующего сигнала из очереди; 0 — очередь пуста.
+int read_signal(int fd);
+
+// Монотонный timerfd. after_ms — до первого срабатывания (0 — выключить),
+// period_ms — далее с этим периодом (0 — однократно).
+int open_timer();
+void arm_timer(int fd, int64_t after_ms, int64_t period_ms);
+// Число срабатываний с прошлого чтения.
+uint64_t read_timer(int fd);
+
+// Поток для долгой работы (проходов по каталогам), чтобы реактор тем временем
+// принимал сигналы. О завершении задачи сообщает eventfd — его регистрируют в
+// реакторе и по готовности вызывают complete(), который выполняет done в потоке
+// реактора. Задача одна за раз.
+class Offload {
+public:
+    Offload() = default;
+    ~Offload();
+    Offload(const Offload &) = delete;
+    Offload &operator=(const Offload &) = delete;
+
+    bool start();
+    // Дожидается текущей задачи; её done уже не вызывается.
+    void stop();
+    // Как Reactor::after_fork: поток остался в родителе.
+    void after_fork();
+
+    int fd() const { return done_fd_; }
+    bool busy() const { return busy_; }
+    void post(std::function<void()> job, std::function<void()> done);
+    void complete();
+
+private:
+    void loop();
+
+    int done_fd_ = -1;
+    bool busy_ = false; // меняется только в потоке реактора
+    std::function<void()> job_, done_;
+    bool ready_ = false, quit_ = false;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::thread thread_;
+};
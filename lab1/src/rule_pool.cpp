@@ -0,0 +1,95 @@
+#include "rule_pool.h"
+
+#include <algorithm>
+
+RulePool::~RulePool() {
+    stop();
+}
+
+void RulePool::start(size_t workers, size_t per_device) {
+    stop();
+    per_device_ = std::max<size_t>(1, per_device);
+    quit_ = false;
+    // при одном потоке правила выполняются прямо в run()
+    if (workers <= 1)
+        return;
+    for (size_t i = 0; i < workers; ++i)
+        threads_.emplace_back(&RulePool::worker_loop, this);
+}
+
+void RulePool::stop() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        quit_ = true;
+    }
+    cv_work_.notify_all();
+    for (auto& t : threads_)
+        t.join();
+    threads_.clear();
+}
+
+static void accumulate(SourceResult& total, const SourceResult& r) {
+    total.moved += r.moved;
+    total.backlog = total.backlog || r.backlog;
+}
+
+SourceResult RulePool::run(std::vector<SourceGroup>& sources, const WorkerOptions& opt,
+                           const std::vector<char>* only) {
+    auto wanted = [&](size_t i) { return !only || (i < only->size() && (*only)[i]); };
+    if (threads_.empty()) {
+        SourceResult total;
+        for (size_t i = 0; i < sources.size(); ++i)
+            if (wanted(i)) {
+                SourceResult r = process_source(sources[i], opt);
+                sources[i].moved = r.moved;
+                accumulate(total, r);
+            }
+        return total;
+    }
+
+    std::unique_lock<std::mutex> lk(mu_);
+    opt_ = opt;
+    total_ = SourceResult{};
+    for (size_t i = 0; i < sources.size(); ++i)
+        if (wanted(i))
+            queue_.push_back(Task{sources[i].dev, &sources[i]});
+    unfinished_ = queue_.size();
+    cv_work_.notify_all();
+    cv_done_.wait(lk, [this] { return unfinished_ == 0; });
+    return total_;
+}
+
+bool RulePool::pick(Task& out) {
+    for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+        if (active_[it->dev] < per_device_) {
+            out = std::move(*it);
+            queue_.erase(it);
+            ++active_[out.dev];
+            return true;
+        }
+    }
+    return false;
+}
+
+void RulePool::worker_loop() {
+    std::unique_lock<std::mutex> lk(mu_);
+    for (;;) {
+        Task t;
+        cv_work_.wait(lk, [&] { return quit_ || pick(t); });
+        if (quit_ && !t.group)
+            return;
+
+        lk.unlock();
+        SourceResult r = process_source(*t.group, opt_);
+        lk.lock();
+
+        t.group->moved = r.moved;
+        accumulate(total_, r);
+        --active_[t.dev];
+        --unfinished_;
+        // освободилось место на устройстве — кто-то из ждущих может взять задачу
+        cv_work_.notify_all();
+        if (unfinished_ == 0)
+            cv_done_.notify_all();
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "config.h"
+#include "file_worker.h"
+
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Пул потоков для параллельного выполнения правил за один тик.
+// Задача — каталог-источник со всеми его правилами (SourceGroup); на одно
+// устройство одновременно работают не более per_device задач.
+class RulePool {
+public:
+    RulePool() = default;
+    ~RulePool();
+    RulePool(const RulePool&) = delete;
+    RulePool& operator=(const RulePool&) = delete;
+
+    void start(size_t workers, size_t per_device);
+    void stop();
+    size_t workers() const { return threads_.size(); }
+
+    // Блокируется, пока не будут обработаны все источники; only — маска по
+    // индексу группы для прохода вне очереди (nullptr — все).
+    SourceResult run(std::vector<SourceGroup>& sources, const WorkerOptions& opt,
+                     const std::vector<char>* only = nullptr);
+
+private:
+    struct Task {
+        dev_t dev = 0;
+        SourceGroup* group = nullptr;
+    };
+
+    void worker_loop();
+    bool pick(Task& out);
+
+    std::mutex mu_;
+    std::condition_variable cv_work_;
+    std::condition_variable cv_done_;
+    std::vector<std::thread> threads_;
+    std::vector<Task> queue_;
+    std::unordered_map<dev_t, size_t> active_;
+    WorkerOptions opt_;
+    SourceResult total_;
+    size_t per_device_ = 1;
+    size_t unfinished_ = 0;
+    bool quit_ = false;
+};
@@ -0,0 +1,131 @@
+#include "schedule.h"
+#include "utils.h"
+
+#include <cstdlib>
+
+static const char *const kDays[] = {"sun", "mon", "tue", "wed", "thu", "fri", "sat"};
+
+static int parse_day(const std::string &s) {
+    for (int i = 0; i < 7; ++i)
+        if (s == kDays[i])
+            return i;
+    return -1;
+}
+
+// "HH:MM" -> минуты суток; "24:00" допустимо как конец отрезка.
+static int parse_clock(const std::string &s) {
+    auto colon = s.find(':');
+    if (colon == std::string::npos || colon == 0 || colon + 3 != s.size())
+        return -1;
+    char *end = nullptr;
+    long h = std::strtol(s.c_str(), &end, 10);
+    if (end != s.c_str() + colon)
+        return -1;
+    long m = std::strtol(s.c_str() + colon + 1, &end, 10);
+    if (*end || h < 0 || m < 0 || m > 59 || h * 60 + m > 24 * 60)
+        return -1;
+    return int(h * 60 + m);
+}
+
+bool parse_window(const std::string &s, Window &out, std::string &err) {
+    Window w;
+    w.text = s;
+    uint8_t days = 0;
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t comma = s.find(',', start);
+        std::string item = to_lower(s.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+        start = comma == std::string::npos ? s.size() + 1 : comma + 1;
+        auto dash = item.find('-');
+        std::string a = item.substr(0, dash), b = dash == std::string::npos ? a : item.substr(dash + 1);
+        if (int d1 = parse_day(a), d2 = parse_day(b); d1 >= 0 && d2 >= 0) {
+            for (int d = d1;; d = (d + 1) % 7) { // "fri-mon" — через воскресенье
+                days |= uint8_t(1u << d);
+                if (d == d2)
+                    break;
+            }
+            continue;
+        }
+        int m1 = parse_clock(a), m2 = parse_clock(b);
+        if (dash == std::string::npos || m1 < 0 || m2 < 0 || m1 == m2 || m1 == 24 * 60) {
+            err = "window expects days (mon-fri) and/or HH:MM-HH:MM, got '" + item + "'";
+            return false;
+        }
+        w.spans.emplace_back(uint16_t(m1), uint16_t(m2));
+    }
+    if (days)
+        w.days = days;
+    out = std::move(w);
+    return true;
+}
+
+bool Window::contains(time_t t) const {
+    if (always())
+        return true;
+    struct tm tm{};
+    localtime_r(&t, &tm);
+    const int wday = tm.tm_wday, prev = (wday + 6) % 7;
+    const int m = tm.tm_hour * 60 + tm.tm_min;
+    auto day = [this](int d) { return (days >> d) & 1; };
+    if (spans.empty())
+        return day(wday);
+    for (const auto &[from, to] : spans) {
+        if (from < to) {
+            if (m >= from && m < to && day(wday))
+                return true;
+        } else if ((m >= from && day(wday)) || (m < to && day(prev))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+time_t Window::next_open(time_t t) const {
+    if (contains(t))
+        return t;
+    // по минутам: за неделю их 10080, а нужно это только закрытым правилам
+    time_t m = t - t % 60 + 60;
+    for (int i = 0; i < 8 * 24 * 60; ++i, m += 60)
+        if (contains(m))
+            return m;
+    return 0;
+}
+
+bool parse_duration(const std::string &s, int &sec) {
+    if (s.empty() || s[0] < '0' || s[0] > '9')
+        return false;
+    char *end = nullptr;
+    unsigned long v = std::strtoul(s.c_str(), &end, 10);
+    std::string suf = to_lower(end);
+    unsigned long mul = suf.empty() || suf == "s" ? 1 : suf == "m" ? 60 : suf == "h" ? 3600 : suf == "d" ? 86400 : 0;
+    if (!mul || v > 0x7fffffffUL / mul)
+        return false;
+    sec = int(v * mul);
+    return true;
+}
+
+void Scheduler::clear() {
+    heap_ = decltype(heap_)();
+    gen_.clear();
+}
+
+void Scheduler::set(size_t id, int64_t due_ms) {
+    if (id >= gen_.size())
+        gen_.resize(id + 1);
+    heap_.push(Entry{due_ms, id, ++gen_[id]});
+}
+
+int64_t Scheduler::next() {
+    while (!heap_.empty() && stale(heap_.top()))
+        heap_.pop();
+    return heap_.empty() ? -1 : heap_.top().due;
+}
+
+void Scheduler::take_due(int64_t now_ms, std::vector<size_t> &out) {
+    for (int64_t due; (due = next()) >= 0 && due <= now_ms; ) {
+        size_t id = heap_.top().id;
+        heap_.pop();
+        ++gen_[id]; // снят с расписания до следующего set
+        out.push_back(id);
+    }
+}
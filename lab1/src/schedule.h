@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Окно работы правила по местному времени, как в cron: дни недели и отрезки
+// суток. "mon-fri,09:00-18:00", "22:00-06:00" (через полночь — день по началу
+// отрезка), "sat,sun". Пустое окно — всегда.
+struct Window {
+    uint8_t days = 0x7f; // бит 0 — воскресенье, как tm_wday
+    std::vector<std::pair<uint16_t, uint16_t>> spans; // минуты суток [from, to)
+    std::string text; // как записано в конфиге
+
+    bool always() const { return days == 0x7f && spans.empty(); }
+    bool contains(time_t t) const;
+    // Ближайшая минута не раньше t, когда окно открыто; 0 — за неделю не открывается.
+    time_t next_open(time_t t) const;
+};
+
+bool parse_window(const std::string &s, Window &out, std::string &err);
+// Секунды с необязательным суффиксом s/m/h/d.
+bool parse_duration(const std::string &s, int &sec);
+
+// Сроки групп-источников: куча по времени с ленивым удалением — перенос срока
+// просто кладёт новую запись, устаревшие отбрасываются при извлечении.
+class Scheduler {
+public:
+    void clear();
+    void set(size_t id, int64_t due_ms);
+    // Ближайший срок; -1 — сроков нет.
+    int64_t next();
+    // Забирает все сроки не позже now.
+    void take_due(int64_t now_ms, std::vector<size_t> &out);
+
+private:
+    struct Entry {
+        int64_t due;
+        size_t id;
+        uint64_t gen;
+        bool operator>(const Entry &o) const { return due > o.due; }
+    };
+    bool stale(const Entry &e) const { return e.id >= gen_.size() || gen_[e.id] != e.gen; }
+
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap_;
+    std::vector<uint64_t> gen_;
+};
@@ -0,0 +1,38 @@
+#include "shard.h"
+#include "xxhash64.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+static constexpr size_t kShardPoints = 64;
+
+// Кольцо строится один раз на число процессов; зовётся только из главного потока.
+static const std::vector<std::pair<uint64_t, size_t>> &ring(size_t shards) {
+    static std::vector<std::pair<uint64_t, size_t>> points;
+    static size_t built = 0;
+    if (built != shards) {
+        points.clear();
+        points.reserve(shards * kShardPoints);
+        for (size_t s = 0; s < shards; ++s)
+            for (size_t i = 0; i < kShardPoints; ++i) {
+                uint64_t id[2] = {s, i};
+                points.emplace_back(xxh64(id, sizeof(id), 0x6c61623164ull), s);
+            }
+        std::sort(points.begin(), points.end());
+        built = shards;
+    }
+    return points;
+}
+
+size_t shard_of(const fs::path &from, size_t shards) {
+    if (shards <= 1)
+        return 0;
+    const std::string &s = from.native();
+    uint64_t h = xxh64(s.data(), s.size());
+    const auto &r = ring(shards);
+    auto it = std::lower_bound(r.begin(), r.end(), std::make_pair(h, size_t(0)));
+    return it == r.end() ? r.front().second : it->second;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Распределение источников по процессам-обработчикам консистентным хешированием:
+// у каждого процесса kShardPoints точек на кольце xxh64, источник принадлежит
+// процессу первой точки не меньше хеша его пути. Когда число процессов меняется
+// с N на N+1, переезжает примерно 1/(N+1) источников, остальные остаются на месте.
+size_t shard_of(const fs::path &from, size_t shards);
@@ -0,0 +1,293 @@
+#include "state_file.h"
+#include "log.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cstring>
+#include <ctime>
+
+static StateBlock *g_state = nullptr;
+
+static bool copy_path(char *dst, const fs::path &p) {
+    const std::string &s = p.native();
+    if (s.size() >= kStatePath)
+        return false;
+    std::memcpy(dst, s.c_str(), s.size() + 1);
+    return true;
+}
+
+bool state_open(const std::string &path) {
+    state_close();
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_msg(LOG_WARNING, "state: open %s: %m", path.c_str());
+        return false;
+    }
+    struct stat st{};
+    bool fresh = fstat(fd, &st) != 0 || st.st_size != off_t(sizeof(StateBlock));
+    if (fresh && ftruncate(fd, sizeof(StateBlock)) != 0) {
+        log_msg(LOG_WARNING, "state: ftruncate %s: %m", path.c_str());
+        close(fd);
+        return false;
+    }
+    void *p = mmap(nullptr, sizeof(StateBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        log_msg(LOG_WARNING, "state: mmap %s: %m", path.c_str());
+        return false;
+    }
+    g_state = static_cast<StateBlock *>(p);
+    if (fresh || g_state->magic != kStateMagic || g_state->version != kStateVersion) {
+        if (!fresh)
+            log_msg(LOG_NOTICE, "state: %s has another layout; starting clean", path.c_str());
+        std::memset(p, 0, sizeof(StateBlock));
+        g_state->version = kStateVersion;
+        g_state->magic = kStateMagic;
+    }
+    return true;
+}
+
+void state_close() {
+    if (!g_state)
+        return;
+    msync(g_state, sizeof(StateBlock), MS_ASYNC);
+    munmap(g_state, sizeof(StateBlock));
+    g_state = nullptr;
+}
+
+// Тот же ли это файл, что был записан в журнал (или он уже заменён другим).
+static bool same_file(const char *path, dev_t dev, ino_t ino) {
+    struct stat st{};
+    return stat(path, &st) == 0 && st.st_dev == dev && st.st_ino == ino;
+}
+
+static bool has_size(const char *path, uint64_t size) {
+    struct stat st{};
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && uint64_t(st.st_size) == size;
+}
+
+static int64_t mtime_of(const char *path) {
+    struct stat st{};
+    if (stat(path, &st) != 0)
+        return -1;
+    return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static size_t chunks_done(const CopyRecord &c) {
+    size_t n = 0;
+    for (uint64_t w : c.done)
+        n += size_t(__builtin_popcountll(w));
+    return n;
+}
+
+// Блочное копирование продолжается, только если источник — тот же неизменённый
+// файл, а временный файл на месте и уже нужного размера (fallocate при старте).
+static bool resumable(const CopyRecord &c) {
+    return c.chunk != 0 && same_file(c.src, dev_t(c.src_dev), ino_t(c.src_ino)) && has_size(c.src, c.size) &&
+           mtime_of(c.src) == c.src_mtime_ns && has_size(c.tmp, c.size);
+}
+
+// Writing: содержимое временного файла ничем не подтверждено — удаляем, источник
+// на месте и уйдёт следующим проходом; исключение — блочное копирование с
+// неизменённым источником, оно остаётся (Resumable) и продолжится с отмеченных
+// кусков. Committing: копия под своим именем, но не сброшена на диск — если
+// источник на месте, удаляем её (перенос повторится), иначе она единственная и
+// остаётся. Placed: копия уже под своим именем — дочищаем источник, если это всё
+// ещё тот самый файл.
+size_t state_recover(pid_t owner) {
+    if (!g_state)
+        return 0;
+    size_t n = 0;
+    for (CopyRecord &c : g_state->copies) {
+        uint32_t phase = c.phase.load();
+        if (phase == CopyFree)
+            continue;
+        // отложенное блочное копирование ничьё: его может подхватить живой обработчик
+        if (owner != 0 && (c.owner != uint32_t(owner) || phase == CopyResumable))
+            continue;
+        ++n;
+        if (phase == CopyWriting || phase == CopyResumable) {
+            if (resumable(c)) {
+                log_msg(LOG_NOTICE, "state: keeping partial copy %s of %s (%zu chunk(s) done)", c.tmp, c.src, chunks_done(c));
+                c.phase.store(CopyResumable);
+                continue;
+            }
+            if (unlink(c.tmp) == 0)
+                log_msg(LOG_NOTICE, "state: dropped unfinished copy %s of %s", c.tmp, c.src);
+        } else if (phase == CopyCommitting) {
+            if (same_file(c.src, dev_t(c.src_dev), ino_t(c.src_ino)) && unlink(c.dst) == 0)
+                log_msg(LOG_NOTICE, "state: dropped uncommitted copy %s of %s", c.dst, c.src);
+        } else if (phase == CopyPlaced) {
+            if (has_size(c.dst, c.size) && same_file(c.src, dev_t(c.src_dev), ino_t(c.src_ino))) {
+                if (unlink(c.src) == 0)
+                    log_msg(LOG_NOTICE, "state: finished move %s -> %s", c.src, c.dst);
+                else
+                    log_msg(LOG_ERR, "state: remove source %s: %m", c.src);
+            }
+        }
+        c.phase.store(CopyFree);
+    }
+    return n;
+}
+
+const RuleRecord *state_find(uint64_t key) {
+    if (!g_state || key == 0)
+        return nullptr;
+    for (size_t i = 0; i < g_state->rule_count && i < kStateRules; ++i)
+        if (__atomic_load_n(&g_state->rules[i].key, __ATOMIC_ACQUIRE) == key)
+            return &g_state->rules[i];
+    return nullptr;
+}
+
+void state_store(size_t i, const RuleRecord &rec) {
+    if (!g_state || i >= kStateRules)
+        return;
+    RuleRecord &r = g_state->rules[i];
+    __atomic_store_n(&r.key, 0, __ATOMIC_RELEASE);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(reinterpret_cast<char *>(&r) + sizeof(r.key), reinterpret_cast<const char *>(&rec) + sizeof(rec.key),
+                sizeof(RuleRecord) - sizeof(rec.key));
+    __atomic_store_n(&r.key, rec.key, __ATOMIC_RELEASE);
+}
+
+void state_end_save(size_t rule_count) {
+    if (!g_state)
+        return;
+    g_state->rule_count = rule_count < kStateRules ? rule_count : kStateRules;
+    g_state->saved = time(nullptr);
+}
+
+int state_copy_begin(const fs::path &src, dev_t dev, ino_t ino, uint64_t size, const fs::path &tmp) {
+    if (!g_state)
+        return -1;
+    for (size_t i = 0; i < kStateCopies; ++i) {
+        CopyRecord &c = g_state->copies[i];
+        uint32_t expected = CopyFree;
+        if (c.phase.load(std::memory_order_relaxed) != CopyFree)
+            continue;
+        // занимаем слот промежуточным значением, пока заполняются поля
+        if (!c.phase.compare_exchange_strong(expected, ~0u))
+            continue;
+        c.owner = uint32_t(getpid());
+        c.src_dev = dev;
+        c.src_ino = ino;
+        c.size = size;
+        c.chunk = 0;
+        c.dst[0] = '\0';
+        if (!copy_path(c.src, src) || !copy_path(c.tmp, tmp)) {
+            c.phase.store(CopyFree);
+            return -1;
+        }
+        c.phase.store(CopyWriting, std::memory_order_release);
+        return static_cast<int>(i);
+    }
+    return -1;
+}
+
+void state_copy_placed(int slot, const fs::path &dst) {
+    if (!g_state || slot < 0)
+        return;
+    CopyRecord &c = g_state->copies[slot];
+    if (!copy_path(c.dst, dst)) {
+        // без пути назначения при восстановлении нечего проверить — слот остаётся
+        // занятым (до state_copy_end), но разбору не подлежит
+        c.phase.store(~0u);
+        return;
+    }
+    c.phase.store(CopyPlaced, std::memory_order_release);
+}
+
+void state_copy_committing(int slot, const fs::path &dst) {
+    if (!g_state || slot < 0)
+        return;
+    CopyRecord &c = g_state->copies[slot];
+    if (!copy_path(c.dst, dst)) {
+        c.phase.store(~0u); // как в state_copy_placed
+        return;
+    }
+    c.phase.store(CopyCommitting, std::memory_order_release);
+}
+
+size_t state_copy_free() {
+    if (!g_state)
+        return kStateCopies;
+    size_t n = 0;
+    for (const CopyRecord &c : g_state->copies)
+        n += c.phase.load(std::memory_order_relaxed) == CopyFree;
+    return n;
+}
+
+void state_copy_end(int slot) {
+    if (g_state && slot >= 0)
+        g_state->copies[slot].phase.store(CopyFree, std::memory_order_release);
+}
+
+int state_copy_resume(dev_t dev, ino_t ino, uint64_t size, int64_t mtime_ns, const fs::path &tmp,
+                      uint64_t &chunk, uint64_t *done) {
+    if (!g_state)
+        return -1;
+    for (size_t i = 0; i < kStateCopies; ++i) {
+        CopyRecord &c = g_state->copies[i];
+        if (c.phase.load(std::memory_order_acquire) != CopyResumable)
+            continue;
+        if (tmp.native() != c.tmp)
+            continue;
+        uint32_t expected = CopyResumable;
+        if (c.src_dev != uint64_t(dev) || c.src_ino != uint64_t(ino) || c.size != size || c.src_mtime_ns != mtime_ns) {
+            // источник с тех пор изменился — tmp будет переписан с нуля, запись не нужна
+            c.phase.compare_exchange_strong(expected, CopyFree);
+            continue;
+        }
+        if (!c.phase.compare_exchange_strong(expected, CopyWriting))
+            continue;
+        c.owner = uint32_t(getpid());
+        chunk = c.chunk;
+        std::memcpy(done, c.done, sizeof(c.done));
+        return static_cast<int>(i);
+    }
+    return -1;
+}
+
+void state_copy_chunked(int slot, uint64_t chunk, int64_t mtime_ns) {
+    if (!g_state || slot < 0)
+        return;
+    CopyRecord &c = g_state->copies[slot];
+    std::memset(c.done, 0, sizeof(c.done));
+    c.src_mtime_ns = mtime_ns;
+    c.chunk = chunk;
+}
+
+void state_copy_progress(int slot, const uint64_t *done) {
+    if (g_state && slot >= 0)
+        std::memcpy(g_state->copies[slot].done, done, sizeof(g_state->copies[slot].done));
+}
+
+void state_copy_suspend(int slot) {
+    if (g_state && slot >= 0 && g_state->copies[slot].chunk != 0)
+        g_state->copies[slot].phase.store(CopyResumable, std::memory_order_release);
+}
+
+std::vector<CopyView> state_copies_in_flight() {
+    std::vector<CopyView> out;
+    if (!g_state)
+        return out;
+    for (const CopyRecord &c : g_state->copies) {
+        uint32_t phase = c.phase.load(std::memory_order_acquire);
+        if (phase != CopyWriting && phase != CopyPlaced && phase != CopyCommitting)
+            continue;
+        CopyView v;
+        v.src.assign(c.src, strnlen(c.src, sizeof(c.src)));
+        v.tmp.assign(c.tmp, strnlen(c.tmp, sizeof(c.tmp)));
+        v.size = c.size;
+        if (c.chunk)
+            v.chunks = size_t((c.size + c.chunk - 1) / c.chunk);
+        v.done = chunks_done(c);
+        v.placed = phase == CopyPlaced;
+        v.committing = phase == CopyCommitting;
+        out.push_back(std::move(v));
+    }
+    return out;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Снимок состояния демона рядом с pid-файлом (<pid>.state), отображённый в память.
+// Переживает перезапуск: курсоры, подсказки индексов имён и счётчики правил
+// сохраняются в конце каждого тика, межустройственные копирования отмечаются
+// в журнале по ходу дела, так что после SIGKILL недоделанное можно разобрать.
+// Раскладка фиксирована и проверяется по magic/version; чужой или старый файл
+// просто переинициализируется. В многопроцессном режиме блок общий: каждый
+// обработчик пишет только записи своих правил.
+
+static constexpr uint32_t kStateMagic = 0x53443131; // "11DS"
+static constexpr uint32_t kStateVersion = 3;
+static constexpr size_t kStateRules = 256;
+static constexpr size_t kStateHints = 64;
+static constexpr size_t kStateCopies = 64;
+static constexpr size_t kStatePath = 512;
+static constexpr size_t kStateChunks = 1024; // кусков в битовой карте блочного копирования
+
+// Наибольший суффикс "(N)" для имени в каталоге назначения; key — xxh64(stem/ext).
+struct SuffixHint {
+    uint64_t key;
+    uint64_t max;
+};
+
+struct RuleRecord {
+    uint64_t key; // xxh64(Rule::key()); 0 — свободно или переписывается
+    uint64_t cursor;
+    uint32_t backlog;
+    uint32_t hint_count;
+    uint64_t moved, renamed, copied, bytes, errors, deduped, dedup_bytes;
+    SuffixHint hints[kStateHints];
+};
+
+enum CopyPhase : uint32_t {
+    CopyFree = 0,
+    CopyWriting = 1, // пишется временный файл, источник нетронут
+    CopyPlaced = 2,  // файл получил имя в назначении, источник ещё не удалён
+    CopyResumable = 3, // блочное копирование прервано; готовые куски отмечены в done
+    CopyCommitting = 4, // файл под своим именем ждёт сброса пачки (durability), источник нетронут
+};
+
+struct CopyRecord {
+    std::atomic<uint32_t> phase;
+    uint32_t owner; // pid процесса, который ведёт копирование; 0 — неизвестен
+    uint64_t src_dev, src_ino, size;
+    // Только у блочного копирования (chunk != 0): по mtime источника видно, что
+    // он не менялся, а done — какие куски уже лежат во временном файле (и на диске).
+    int64_t src_mtime_ns;
+    uint64_t chunk;
+    uint64_t done[kStateChunks / 64];
+    char src[kStatePath];
+    char tmp[kStatePath];
+    char dst[kStatePath];
+};
+
+struct StateBlock {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t rule_count;
+    int64_t saved; // unix time последнего сохранения
+    RuleRecord rules[kStateRules];
+    CopyRecord copies[kStateCopies];
+};
+
+bool state_open(const std::string &path);
+void state_close();
+
+// Разбирает журнал копирований прошлого запуска; возвращает число записей.
+// owner != 0 — только записи этого (уже умершего) процесса: упавший обработчик
+// не должен держать слоты журнала и временные файлы до перезапуска демона.
+size_t state_recover(pid_t owner = 0);
+
+// Запись правила из прошлого снимка; nullptr — такого правила не было.
+const RuleRecord *state_find(uint64_t key);
+// Запись i-го правила; на время записи её key обнулён, так что оборванная
+// посередине запись при следующем запуске просто не находится.
+void state_store(size_t i, const RuleRecord &rec);
+void state_end_save(size_t rule_count);
+
+// Журнал межустройственных копирований; -1 — журнал выключен или полон.
+int state_copy_begin(const fs::path &src, dev_t dev, ino_t ino, uint64_t size, const fs::path &tmp);
+void state_copy_placed(int slot, const fs::path &dst);
+void state_copy_end(int slot);
+// Копия получила имя dst, но ещё не сброшена на диск (CommitBatch).
+void state_copy_committing(int slot, const fs::path &dst);
+// Свободных записей журнала; без журнала — kStateCopies.
+size_t state_copy_free();
+
+// Блочное копирование с продолжением. state_copy_resume ищет прерванное копирование
+// того же источника в тот же tmp и забирает запись себе (chunk и done — оттуда).
+// Новое копирование: state_copy_begin, затем state_copy_chunked.
+int state_copy_resume(dev_t dev, ino_t ino, uint64_t size, int64_t mtime_ns, const fs::path &tmp,
+                      uint64_t &chunk, uint64_t *done);
+void state_copy_chunked(int slot, uint64_t chunk, int64_t mtime_ns);
+// done уже сброшены на диск (fdatasync временного файла до вызова).
+void state_copy_progress(int slot, const uint64_t *done);
+// Остановка посреди копирования: запись остаётся для продолжения.
+void state_copy_suspend(int slot);
+
+// Идущие сейчас копирования (по журналу — во всех процессах демона).
+struct CopyView {
+    std::string src, tmp;
+    uint64_t size = 0;
+    size_t chunks = 0, done = 0; // у блочного копирования
+    bool placed = false;         // размещено, ждёт удаления источника
+    bool committing = false;     // размещено, ждёт сброса пачки на диск
+};
+std::vector<CopyView> state_copies_in_flight();
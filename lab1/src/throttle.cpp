@@ -0,0 +1,130 @@
+#include "throttle.h"
+#include "log.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+// <linux/ioprio.h> есть не везде — константы ядра.
+static constexpr int kIoprioWhoProcess = 1;
+static constexpr int kIoprioClassShift = 13;
+static constexpr int kIoprioClassBe = 2;
+static constexpr int kIoprioClassIdle = 3;
+static constexpr uint64_t kWaitSlice = 100000; // мкс
+
+static TokenBucket g_bytes, g_ops;
+
+void TokenBucket::set_rate(uint64_t rate) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (rate != rate_.load(std::memory_order_relaxed))
+        tokens_ = double(rate);
+    rate_.store(rate, std::memory_order_relaxed);
+    last_ = std::chrono::steady_clock::now();
+}
+
+uint64_t TokenBucket::reserve(uint64_t n) {
+    if (rate() == 0)
+        return 0;
+    std::lock_guard<std::mutex> lk(mu_);
+    const double rate = double(rate_.load(std::memory_order_relaxed));
+    if (rate == 0)
+        return 0;
+    auto now = std::chrono::steady_clock::now();
+    tokens_ = std::min(rate, tokens_ + std::chrono::duration<double>(now - last_).count() * rate);
+    last_ = now;
+    tokens_ -= double(n);
+    return tokens_ >= 0 ? 0 : uint64_t(-tokens_ / rate * 1e6);
+}
+
+void Throttle::reset(TokenBucket *bytes, TokenBucket *ops, const std::atomic<bool> *stop,
+                     const std::atomic<bool> *reload) {
+    bytes_ = bytes;
+    ops_ = ops;
+    stop_ = stop;
+    reload_ = reload;
+    waited_.store(0, std::memory_order_relaxed);
+}
+
+void Throttle::wait(uint64_t us) {
+    while (us > 0 && !(stop_ && *stop_) && !(reload_ && *reload_)) {
+        uint64_t step = std::min(us, kWaitSlice);
+        usleep(static_cast<useconds_t>(step));
+        waited_.fetch_add(step, std::memory_order_relaxed);
+        us -= step;
+    }
+}
+
+void Throttle::bytes(uint64_t n) {
+    uint64_t us = g_bytes.reserve(n);
+    if (bytes_)
+        us = std::max(us, bytes_->reserve(n));
+    wait(us);
+}
+
+void Throttle::op(uint64_t n) {
+    uint64_t us = g_ops.reserve(n);
+    if (ops_)
+        us = std::max(us, ops_->reserve(n));
+    wait(us);
+}
+
+void throttle_set_global(uint64_t bytes_per_sec, uint64_t ops_per_sec) {
+    g_bytes.set_rate(bytes_per_sec);
+    g_ops.set_rate(ops_per_sec);
+}
+
+bool parse_ioprio(const std::string &s, int &out) {
+    if (s == "off" || s == "none") {
+        out = -1;
+        return true;
+    }
+    if (s == "idle") {
+        out = kIoprioClassIdle << kIoprioClassShift;
+        return true;
+    }
+    if (s == "be") {
+        out = (kIoprioClassBe << kIoprioClassShift) | 4;
+        return true;
+    }
+    if (s.size() == 4 && s.compare(0, 3, "be:") == 0 && s[3] >= '0' && s[3] <= '7') {
+        out = (kIoprioClassBe << kIoprioClassShift) | (s[3] - '0');
+        return true;
+    }
+    return false;
+}
+
+std::string ioprio_name(int prio) {
+    if (prio < 0)
+        return "off";
+    if ((prio >> kIoprioClassShift) == kIoprioClassIdle)
+        return "idle";
+    return "be:" + std::to_string(prio & 7);
+}
+
+static int ioprio_get_self() {
+    return static_cast<int>(syscall(SYS_ioprio_get, kIoprioWhoProcess, 0));
+}
+
+static void ioprio_set_self(int prio) {
+    // who=0 при IOPRIO_WHO_PROCESS — вызывающий поток
+    if (syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, prio) != 0)
+        log_msg(LOG_WARNING, "ioprio_set %s: %m", ioprio_name(prio).c_str());
+}
+
+IoprioScope::IoprioScope(int prio) {
+    if (prio < 0)
+        return;
+    saved_ = ioprio_get_self();
+    if (saved_ == prio) {
+        saved_ = -1;
+        return;
+    }
+    if (saved_ >= 0)
+        ioprio_set_self(prio);
+}
+
+IoprioScope::~IoprioScope() {
+    if (saved_ >= 0)
+        ioprio_set_self(saved_);
+}
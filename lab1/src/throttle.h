@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Корзина токенов: rate в секунду, запас — на одну секунду. Взятое сверх запаса
+// уходит в долг, и следующий берущий ждёт, пока долг не погасится, так что
+// крупный запрос (кусок копирования) не ждёт вечно, а средняя скорость держится.
+class TokenBucket {
+public:
+    void set_rate(uint64_t rate); // 0 — без ограничения
+    uint64_t rate() const { return rate_.load(std::memory_order_relaxed); }
+    // Берёт n токенов и возвращает, сколько микросекунд нужно подождать.
+    uint64_t reserve(uint64_t n);
+
+private:
+    std::mutex mu_;
+    std::atomic<uint64_t> rate_{0};
+    double tokens_ = 0;
+    std::chrono::steady_clock::time_point last_{};
+};
+
+// Ограничения одного правила плюс общие на процесс: берётся максимум ожиданий.
+// Ждёт кусками, проверяя флаги демона, чтобы остановка не стояла за лимитом.
+// Потокобезопасен: им пользуются и потоки блочного копирования, и обход дерева.
+class Throttle {
+public:
+    void reset(TokenBucket *bytes, TokenBucket *ops, const std::atomic<bool> *stop,
+               const std::atomic<bool> *reload);
+    void bytes(uint64_t n);
+    void op(uint64_t n = 1);
+    uint64_t waited_us() const { return waited_.load(std::memory_order_relaxed); }
+
+private:
+    void wait(uint64_t us);
+
+    TokenBucket *bytes_ = nullptr;
+    TokenBucket *ops_ = nullptr;
+    const std::atomic<bool> *stop_ = nullptr;
+    const std::atomic<bool> *reload_ = nullptr;
+    std::atomic<uint64_t> waited_{0};
+};
+
+// Общие на процесс лимиты (rate_bytes/rate_ops вне правил).
+void throttle_set_global(uint64_t bytes_per_sec, uint64_t ops_per_sec);
+
+// Класс ввода-вывода потока: "idle", "be", "be:N" (N — 0..7), "off".
+// -1 — не трогать (off); иначе значение для ioprio_set.
+bool parse_ioprio(const std::string &s, int &out);
+std::string ioprio_name(int prio);
+
+// Ставит потоку класс ввода-вывода на время жизни объекта; потоки, порождённые
+// внутри (обход дерева, блочное копирование), его наследуют.
+class IoprioScope {
+public:
+    explicit IoprioScope(int prio);
+    ~IoprioScope();
+    IoprioScope(const IoprioScope &) = delete;
+    IoprioScope &operator=(const IoprioScope &) = delete;
+
+private:
+    int saved_ = -1;
+};
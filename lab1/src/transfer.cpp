@@ -0,0 +1,747 @@
+#include "transfer.h"
+#include "log.h"
+#include "state_file.h"
+
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+static constexpr const char *kTempPrefix = ".lab1d-";
+static constexpr size_t kChunk = 1 << 20;
+static constexpr uint64_t kBigChunk = 64ull << 20;
+static constexpr size_t kDirectAlign = 4096;
+static constexpr size_t kCheckpointChunks = 4; // fdatasync и отметка в журнале не чаще
+static constexpr off_t kFanoutParallelMin = 8 << 20; // меньше — копии пишутся по очереди
+
+static TransferOptions g_opts;
+
+void transfer_set_options(const TransferOptions &o) {
+    g_opts = o;
+}
+
+const char *transfer_method_name(TransferMethod m) {
+    switch (m) {
+        case TransferMethod::Reflink:       return "reflink";
+        case TransferMethod::CopyFileRange: return "copy_file_range";
+        case TransferMethod::Sendfile:      return "sendfile";
+        case TransferMethod::Splice:        return "splice";
+        case TransferMethod::ReadWrite:     return "read/write";
+        case TransferMethod::Hardlink:      return "link";
+        case TransferMethod::None:          break;
+    }
+    return "none";
+}
+
+bool is_transfer_temp(const std::string &name) {
+    return name.compare(0, std::strlen(kTempPrefix), kTempPrefix) == 0;
+}
+
+// Ошибки, после которых имеет смысл попробовать следующий способ, а не сдаваться.
+static bool method_unsupported(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == ENOTTY || err == EBADF;
+}
+
+// Лимит скорости берётся перед каждым куском, так что копирование идёт ровно.
+static void pace(Throttle *t, off_t off, off_t end) {
+    if (t)
+        t->bytes(uint64_t(std::min<off_t>(end - off, kChunk)));
+}
+
+static bool copy_cfr(int in, int out, off_t size, off_t &off, Throttle *t) {
+    while (off < size) {
+        pace(t, off, size);
+        ssize_t n = copy_file_range(in, &off, out, nullptr, kChunk, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) break;
+    }
+    return true;
+}
+
+static bool copy_sendfile(int in, int out, off_t size, off_t &off, Throttle *t) {
+    while (off < size) {
+        pace(t, off, size);
+        ssize_t n = sendfile(out, in, &off, kChunk);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) break;
+    }
+    return true;
+}
+
+static bool copy_splice(int in, int out, off_t size, off_t &off, Throttle *t) {
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) != 0)
+        return false;
+    bool ok = true;
+    while (ok && off < size) {
+        pace(t, off, size);
+        ssize_t n = splice(in, &off, p[1], nullptr, kChunk, SPLICE_F_MOVE);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+        if (n == 0) break;
+        while (n > 0) {
+            ssize_t w = splice(p[0], nullptr, out, nullptr, n, SPLICE_F_MOVE);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                // недописанное осталось в канале — откатываем смещение, чтобы
+                // следующий способ начал с первого незаписанного байта
+                off -= n;
+                ok = false;
+                break;
+            }
+            n -= w;
+        }
+    }
+    int saved = errno;
+    close(p[0]);
+    close(p[1]);
+    errno = saved;
+    return ok;
+}
+
+static bool copy_rw(int in, int out, off_t size, off_t &off, Throttle *t) {
+    static thread_local char buf[64 * 1024];
+    while (off < size) {
+        if (t)
+            t->bytes(uint64_t(std::min<off_t>(size - off, off_t(sizeof(buf)))));
+        ssize_t n = pread(in, buf, sizeof(buf), off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) break;
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t w = pwrite(out, buf + done, n - done, off + done);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            done += w;
+        }
+        off += n;
+    }
+    return true;
+}
+
+// Каждый следующий способ продолжает с того места, где остановился предыдущий.
+static TransferMethod copy_stream(int in, int out, off_t size, off_t &off, Throttle *t) {
+    if (copy_cfr(in, out, size, off, t))
+        return TransferMethod::CopyFileRange;
+    if (!method_unsupported(errno))
+        return TransferMethod::None;
+    if (copy_sendfile(in, out, size, off, t))
+        return TransferMethod::Sendfile;
+    if (!method_unsupported(errno))
+        return TransferMethod::None;
+    if (copy_splice(in, out, size, off, t))
+        return TransferMethod::Splice;
+    if (!method_unsupported(errno))
+        return TransferMethod::None;
+    if (copy_rw(in, out, size, off, t))
+        return TransferMethod::ReadWrite;
+    return TransferMethod::None;
+}
+
+static TransferMethod copy_data(int in, int out, off_t size, Throttle *t) {
+    if (ioctl(out, FICLONE, in) == 0)
+        return TransferMethod::Reflink;
+    off_t off = 0;
+    TransferMethod m = copy_stream(in, out, size, off, t);
+    if (m != TransferMethod::None && off < size) {
+        errno = ENODATA; // источник укоротился на ходу — копия неполная
+        return TransferMethod::None;
+    }
+    return m;
+}
+
+// ---- блочное копирование больших файлов ----
+
+static int64_t mtime_ns(const struct stat &st) {
+    return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// Куски не мельче 64 МиБ и не больше kStateChunks на файл; кратны 1 МиБ,
+// так что их границы годятся и для O_DIRECT.
+static uint64_t chunk_size_for(uint64_t size) {
+    uint64_t c = std::max<uint64_t>(kBigChunk, (size + kStateChunks - 1) / kStateChunks);
+    return (c + kChunk - 1) / kChunk * kChunk;
+}
+
+namespace {
+
+struct ChunkedCopy {
+    int in = -1, out = -1;
+    int in_direct = -1, out_direct = -1;
+    uint64_t size = 0, chunk = 0;
+    size_t count = 0;
+    int journal = -1;
+    Throttle *throttle = nullptr;
+    std::atomic<size_t> next{0};
+    std::atomic<uint64_t> done[kStateChunks / 64] = {};
+    std::atomic<bool> use_cfr{true};
+    std::atomic<bool> failed{false};
+    std::atomic<bool> stopped{false};
+    std::atomic<int> err{0};
+    std::atomic<size_t> since_checkpoint{0};
+    std::mutex checkpoint_mu;
+};
+
+} // namespace
+
+// copy_file_range с явными смещениями обеих сторон — куски пишутся параллельно.
+static bool range_cfr(int in, int out, off_t &off, off_t end, Throttle *t) {
+    while (off < end) {
+        pace(t, off, end);
+        off_t out_off = off;
+        ssize_t n = copy_file_range(in, &off, out, &out_off, size_t(std::min<off_t>(end - off, kChunk)), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) break;
+    }
+    return true;
+}
+
+// Выровненная часть куска мимо кэша страниц; buf выровнен на kDirectAlign.
+static bool range_direct(int in, int out, char *buf, off_t &off, off_t end, Throttle *t) {
+    while (off < end) {
+        pace(t, off, end);
+        ssize_t n = pread(in, buf, size_t(std::min<off_t>(end - off, kChunk)), off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0 || n % ssize_t(kDirectAlign) != 0) {
+            errno = ENODATA;
+            return false;
+        }
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t w = pwrite(out, buf + done, size_t(n - done), off + done);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            done += w;
+        }
+        off += n;
+    }
+    return true;
+}
+
+static bool copy_range(ChunkedCopy &j, char *buf, off_t &off, off_t end) {
+    if (buf) {
+        // невыровненный хвост файла — обычным путём
+        if (!range_direct(j.in_direct, j.out_direct, buf, off, end & ~off_t(kDirectAlign - 1), j.throttle))
+            return false;
+        return copy_rw(j.in, j.out, end, off, j.throttle);
+    }
+    if (j.use_cfr.load(std::memory_order_relaxed)) {
+        if (range_cfr(j.in, j.out, off, end, j.throttle))
+            return true;
+        if (!method_unsupported(errno))
+            return false;
+        j.use_cfr.store(false, std::memory_order_relaxed); // продолжаем с того же места
+    }
+    return copy_rw(j.in, j.out, end, off, j.throttle);
+}
+
+// Отмечаются только куски, уже сброшенные на диск. Пока один поток ждёт
+// fdatasync, остальные не ждут его и копируют дальше.
+static void checkpoint(ChunkedCopy &j, bool force) {
+    if (!force && j.since_checkpoint.fetch_add(1) + 1 < kCheckpointChunks)
+        return;
+    std::unique_lock<std::mutex> lk(j.checkpoint_mu, std::defer_lock);
+    if (force)
+        lk.lock();
+    else if (!lk.try_lock())
+        return;
+    j.since_checkpoint.store(0);
+    uint64_t snap[kStateChunks / 64];
+    for (size_t w = 0; w < kStateChunks / 64; ++w)
+        snap[w] = j.done[w].load();
+    if (fdatasync(j.out) != 0)
+        return;
+    state_copy_progress(j.journal, snap);
+    if (j.out_direct < 0)
+        posix_fadvise(j.out, 0, 0, POSIX_FADV_DONTNEED); // сброшенное больше не нужно в кэше
+}
+
+static void chunk_worker(ChunkedCopy &j) {
+    std::unique_ptr<char, void (*)(void *)> buf(nullptr, std::free);
+    if (j.in_direct >= 0)
+        buf.reset(static_cast<char *>(std::aligned_alloc(kDirectAlign, kChunk)));
+    if (j.in_direct >= 0 && !buf) {
+        j.err.store(ENOMEM);
+        j.failed.store(true);
+        return;
+    }
+    while (!j.failed.load(std::memory_order_relaxed)) {
+        if (g_opts.stop && *g_opts.stop) {
+            j.stopped.store(true);
+            return;
+        }
+        size_t i = j.next.fetch_add(1);
+        if (i >= j.count)
+            return;
+        if (j.done[i / 64].load(std::memory_order_relaxed) & (1ull << (i % 64)))
+            continue;
+        off_t start = off_t(i * j.chunk), off = start;
+        off_t end = off_t(std::min<uint64_t>(j.size, (i + 1) * j.chunk));
+        bool ok = copy_range(j, buf.get(), off, end);
+        if (ok && off < end) {
+            ok = false;
+            errno = ENODATA; // источник укоротился на ходу
+        }
+        if (!ok) {
+            j.err.store(errno);
+            j.failed.store(true);
+            return;
+        }
+        if (j.in_direct < 0)
+            posix_fadvise(j.in, start, end - start, POSIX_FADV_DONTNEED);
+        j.done[i / 64].fetch_or(1ull << (i % 64));
+        checkpoint(j, false);
+    }
+}
+
+// Файл по имени в каталоге: O_DIRECT-дескрипторы открываются заново относительно него.
+struct AtName {
+    int dir;
+    const char *name;
+};
+
+// done/chunk — из журнала, если копирование продолжается (chunk != 0).
+static TransferMethod copy_chunked(const fs::path &src, AtName src_at, AtName tmp_at, int in, int out, const struct stat &st,
+                                   int journal, uint64_t chunk, const uint64_t *done, Throttle *t, bool &suspended) {
+    const uint64_t size = uint64_t(st.st_size);
+    const bool resumed = chunk != 0;
+    if (!resumed) {
+        if (ioctl(out, FICLONE, in) == 0)
+            return TransferMethod::Reflink;
+        chunk = chunk_size_for(size);
+        // место целиком и сразу: ENOSPC — до копирования, а не на сороковом гигабайте
+        if (fallocate(out, 0, 0, off_t(size)) != 0 && (errno != EOPNOTSUPP || ftruncate(out, off_t(size)) != 0))
+            return TransferMethod::None;
+        state_copy_chunked(journal, chunk, mtime_ns(st));
+    }
+
+    ChunkedCopy j;
+    j.in = in;
+    j.out = out;
+    j.size = size;
+    j.chunk = chunk;
+    j.count = size_t((size + chunk - 1) / chunk);
+    j.journal = journal;
+    j.throttle = t;
+    size_t todo = j.count;
+    for (size_t i = 0; done && i < j.count; ++i)
+        if (done[i / 64] & (1ull << (i % 64))) {
+            j.done[i / 64].fetch_or(1ull << (i % 64));
+            --todo;
+        }
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (g_opts.direct) {
+        j.in_direct = openat(src_at.dir, src_at.name, O_RDONLY | O_DIRECT | O_CLOEXEC);
+        j.out_direct = j.in_direct < 0 ? -1 : openat(tmp_at.dir, tmp_at.name, O_WRONLY | O_DIRECT | O_CLOEXEC);
+        if (j.out_direct < 0) {
+            log_msg(LOG_WARNING, "transfer: O_DIRECT unavailable for %s: %m; using page cache", src.c_str());
+            if (j.in_direct >= 0)
+                close(j.in_direct);
+            j.in_direct = -1;
+        }
+    }
+
+    unsigned threads = unsigned(std::clamp<size_t>(g_opts.threads, 1, std::max<size_t>(todo, 1)));
+    std::vector<std::thread> helpers;
+    try {
+        for (unsigned t = 1; t < threads; ++t)
+            helpers.emplace_back(chunk_worker, std::ref(j));
+    } catch (const std::system_error &e) {
+        log_msg(LOG_WARNING, "transfer: copy thread: %s; continuing with %zu", e.what(), helpers.size() + 1);
+    }
+    chunk_worker(j);
+    for (std::thread &h : helpers)
+        h.join();
+    if (j.in_direct >= 0)
+        close(j.in_direct);
+    if (j.out_direct >= 0)
+        close(j.out_direct);
+
+    size_t finished = 0;
+    for (size_t w = 0; w < kStateChunks / 64; ++w)
+        finished += size_t(__builtin_popcountll(j.done[w].load()));
+    if (j.failed.load()) {
+        errno = j.err.load();
+        return TransferMethod::None;
+    }
+    if (finished < j.count) {
+        checkpoint(j, true);
+        suspended = true;
+        errno = EINTR;
+        return TransferMethod::None;
+    }
+    log_msg(LOG_INFO, "transfer: %s: %zu chunk(s) of %llu MiB in %zu thread(s)%s%s", src.c_str(), j.count,
+            (unsigned long long)(chunk >> 20), helpers.size() + 1, j.in_direct >= 0 ? ", O_DIRECT" : "",
+            resumed ? ", resumed" : "");
+    return j.use_cfr.load() && j.in_direct < 0 ? TransferMethod::CopyFileRange : TransferMethod::ReadWrite;
+}
+
+TransferResult transfer_file(int from_fd, const char *name, const fs::path &from_dir, DestIndex &dest,
+                             bool unlink_src, Throttle *throttle) {
+    TransferResult res;
+    // Полные пути — только для журнала снимка и сообщений; на фоне копирования они ничего не стоят.
+    const fs::path src = from_dir / name;
+
+    int in = openat(from_fd, name, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        log_msg(LOG_ERR, "transfer: open %s: %m", src.c_str());
+        return res;
+    }
+    struct stat st{};
+    if (fstat(in, &st) != 0) {
+        log_msg(LOG_ERR, "transfer: fstat %s: %m", src.c_str());
+        close(in);
+        return res;
+    }
+    const int to_fd = dest.fd();
+    if (to_fd < 0) {
+        log_msg(LOG_ERR, "transfer: open %s: %m", dest.dir().c_str());
+        close(in);
+        return res;
+    }
+
+    // Имя временного файла однозначно определяется исходником, поэтому
+    // остаток от прерванного переноса просто перезаписывается.
+    char tmp_name[64];
+    std::snprintf(tmp_name, sizeof(tmp_name), "%s%llx-%llx.part", kTempPrefix,
+                  (unsigned long long)st.st_dev, (unsigned long long)st.st_ino);
+    const fs::path tmp = dest.dir() / tmp_name;
+
+    // Большой файл, копирование которого прервали, продолжается в тот же tmp.
+    const bool large = g_opts.chunked_min != 0 && uint64_t(st.st_size) >= g_opts.chunked_min;
+    uint64_t chunk = 0;
+    uint64_t done[kStateChunks / 64] = {};
+    int journal = large ? state_copy_resume(st.st_dev, st.st_ino, uint64_t(st.st_size), mtime_ns(st), tmp, chunk, done) : -1;
+    const bool resumed = journal >= 0;
+
+    int out = openat(to_fd, tmp_name, O_WRONLY | O_CREAT | (resumed ? 0 : O_TRUNC) | O_CLOEXEC, 0600);
+    if (out < 0) {
+        log_msg(LOG_ERR, "transfer: create %s: %m", tmp.c_str());
+        state_copy_suspend(journal);
+        close(in);
+        return res;
+    }
+
+    if (!resumed)
+        journal = state_copy_begin(src, st.st_dev, st.st_ino, uint64_t(st.st_size), tmp);
+    bool suspended = false;
+    res.method = large ? copy_chunked(src, AtName{from_fd, name}, AtName{to_fd, tmp_name}, in, out, st, journal,
+                                      chunk, resumed ? done : nullptr, throttle, suspended)
+                       : copy_data(in, out, st.st_size, throttle);
+    int copy_err = errno;
+    bool ok = res.method != TransferMethod::None;
+    if (ok && fchmod(out, st.st_mode & 07777) != 0)
+        log_msg(LOG_WARNING, "transfer: fchmod %s: %m", tmp.c_str());
+    if (close(out) != 0 && ok) {
+        copy_err = errno;
+        ok = false;
+    }
+    close(in);
+
+    if (!ok && suspended && journal >= 0) {
+        log_msg(LOG_NOTICE, "transfer: %s stopped; partial copy kept for resume", src.c_str());
+        state_copy_suspend(journal);
+        res.suspended = true;
+        return res;
+    }
+    if (!ok) {
+        log_msg(LOG_ERR, "transfer: copy %s -> %s: %s", src.c_str(), dest.dir().c_str(), std::strerror(copy_err));
+        unlinkat(to_fd, tmp_name, 0);
+        state_copy_end(journal);
+        res.method = TransferMethod::None;
+        return res;
+    }
+
+    if (int err = dest.commit(to_fd, tmp_name, name, &res.dst); err != 0) {
+        log_msg(LOG_ERR, "transfer: rename %s -> %s: %s", tmp.c_str(), dest.dir().c_str(), std::strerror(err));
+        unlinkat(to_fd, tmp_name, 0);
+        state_copy_end(journal);
+        res.method = TransferMethod::None;
+        return res;
+    }
+    if (unlink_src) {
+        state_copy_placed(journal, res.dst);
+        if (unlinkat(from_fd, name, 0) != 0)
+            log_msg(LOG_ERR, "transfer: remove source %s: %m", src.c_str());
+        state_copy_end(journal);
+    } else {
+        res.journal = journal;
+    }
+
+    res.bytes = static_cast<uint64_t>(st.st_size);
+    res.ok = true;
+    return res;
+}
+
+// ---- fanout: один источник, несколько назначений ----
+
+static bool write_all(int fd, const char *buf, size_t n, off_t off) {
+    for (size_t done = 0; done < n; ) {
+        ssize_t w = pwrite(fd, buf + done, n - done, off + off_t(done));
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        done += size_t(w);
+    }
+    return true;
+}
+
+namespace {
+
+// Писатели остальных копий: каждый блок, прочитанный ведущим потоком, пишут все
+// сразу; следующий блок читается, когда дописан предыдущий.
+struct FanoutWriters {
+    std::mutex mu;
+    std::condition_variable cv;
+    const char *buf = nullptr;
+    size_t len = 0;
+    off_t off = 0;
+    uint64_t gen = 0;
+    size_t pending = 0;
+    bool quit = false;
+    int err = 0;
+};
+
+} // namespace
+
+static void fanout_writer(FanoutWriters &fw, int out) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lk(fw.mu);
+    for (;;) {
+        fw.cv.wait(lk, [&] { return fw.quit || fw.gen != seen; });
+        if (fw.quit)
+            return;
+        seen = fw.gen;
+        const char *buf = fw.buf;
+        const size_t len = fw.len;
+        const off_t off = fw.off;
+        lk.unlock();
+        bool ok = write_all(out, buf, len, off);
+        int err = errno;
+        lk.lock();
+        if (!ok && !fw.err)
+            fw.err = err;
+        if (--fw.pending == 0)
+            fw.cv.notify_all();
+    }
+}
+
+// Один проход чтения на все outs; с двух копий и от kFanoutParallelMin остальные
+// копии пишут свои потоки, пока ведущий пишет первую.
+static bool copy_fanout(int in, const std::vector<int> &outs, off_t size, Throttle *t, bool &stopped) {
+    std::unique_ptr<char[]> buf(new char[kChunk]);
+    FanoutWriters fw;
+    std::vector<std::thread> writers;
+    if (outs.size() > 1 && size >= kFanoutParallelMin)
+        for (size_t i = 1; i < outs.size(); ++i)
+            writers.emplace_back(fanout_writer, std::ref(fw), outs[i]);
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    bool ok = true;
+    for (off_t off = 0; ok && off < size; ) {
+        if (g_opts.stop && *g_opts.stop) {
+            stopped = true;
+            errno = EINTR;
+            ok = false;
+            break;
+        }
+        if (t)
+            t->bytes(uint64_t(std::min<off_t>(size - off, kChunk)) * outs.size());
+        ssize_t n = pread(in, buf.get(), kChunk, off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0)
+            errno = ENODATA; // источник укоротился на ходу — копии неполные
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        if (!writers.empty()) {
+            std::lock_guard<std::mutex> lk(fw.mu);
+            fw.buf = buf.get();
+            fw.len = size_t(n);
+            fw.off = off;
+            fw.pending = writers.size();
+            ++fw.gen;
+        }
+        fw.cv.notify_all();
+        ok = write_all(outs[0], buf.get(), size_t(n), off);
+        int err = errno;
+        for (size_t i = 1; ok && writers.empty() && i < outs.size(); ++i) {
+            ok = write_all(outs[i], buf.get(), size_t(n), off);
+            err = errno;
+        }
+        if (!writers.empty()) {
+            std::unique_lock<std::mutex> lk(fw.mu);
+            fw.cv.wait(lk, [&] { return fw.pending == 0; });
+            if (ok && fw.err) {
+                ok = false;
+                err = fw.err;
+            }
+        }
+        errno = err;
+        off += n;
+    }
+    int saved = errno;
+    {
+        std::lock_guard<std::mutex> lk(fw.mu);
+        fw.quit = true;
+    }
+    fw.cv.notify_all();
+    for (auto &w : writers)
+        w.join();
+    errno = saved;
+    return ok;
+}
+
+FanoutResult fanout_file(int from_fd, const char *name, const fs::path &from_dir, const std::vector<DestIndex *> &dests,
+                         Throttle *throttle) {
+    FanoutResult res;
+    const fs::path src = from_dir / name;
+    int in = openat(from_fd, name, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        log_msg(LOG_ERR, "fanout: open %s: %m", src.c_str());
+        return res;
+    }
+    struct stat st{};
+    if (fstat(in, &st) != 0) {
+        log_msg(LOG_ERR, "fanout: fstat %s: %m", src.c_str());
+        close(in);
+        return res;
+    }
+    char tmp_name[64];
+    std::snprintf(tmp_name, sizeof(tmp_name), "%s%llx-%llx.part", kTempPrefix,
+                  (unsigned long long)st.st_dev, (unsigned long long)st.st_ino);
+
+    // Сначала всё, что не требует чтения: ссылки и reflink; остальное — в общий проход.
+    res.copies.resize(dests.size());
+    std::vector<int> to_fd(dests.size(), -1), out(dests.size(), -1);
+    std::vector<char> staged(dests.size()), committed(dests.size());
+    std::vector<size_t> copying;
+    bool ok = true;
+    for (size_t i = 0; ok && i < dests.size(); ++i) {
+        Delivery &d = res.copies[i];
+        struct stat ds{};
+        to_fd[i] = dests[i]->fd();
+        if (to_fd[i] < 0 || fstat(to_fd[i], &ds) != 0) {
+            log_msg(LOG_ERR, "fanout: open %s: %m", dests[i]->dir().c_str());
+            ok = false;
+            break;
+        }
+        d.journal = state_copy_begin(src, st.st_dev, st.st_ino, uint64_t(st.st_size), dests[i]->dir() / tmp_name);
+        staged[i] = true;
+        if (ds.st_dev == st.st_dev) {
+            unlinkat(to_fd[i], tmp_name, 0); // остаток прерванной доставки
+            if (linkat(from_fd, name, to_fd[i], tmp_name, 0) == 0) {
+                d.method = TransferMethod::Hardlink;
+                continue;
+            }
+            // та же ФС, но другая точка монтирования (EXDEV) — копируем
+        }
+        out[i] = openat(to_fd[i], tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (out[i] < 0) {
+            log_msg(LOG_ERR, "fanout: create %s: %m", (dests[i]->dir() / tmp_name).c_str());
+            ok = false;
+            break;
+        }
+        if (ioctl(out[i], FICLONE, in) == 0)
+            d.method = TransferMethod::Reflink;
+        else
+            copying.push_back(i);
+    }
+
+    if (ok && !copying.empty()) {
+        std::vector<int> fds;
+        for (size_t i : copying)
+            fds.push_back(out[i]);
+        bool stopped = false;
+        TransferMethod m = TransferMethod::ReadWrite;
+        if (fds.size() == 1)
+            m = copy_data(in, fds[0], st.st_size, throttle);
+        else if (!copy_fanout(in, fds, st.st_size, throttle, stopped))
+            m = TransferMethod::None;
+        if (m == TransferMethod::None) {
+            if (stopped)
+                log_msg(LOG_NOTICE, "fanout: %s stopped; will be delivered again", src.c_str());
+            else
+                log_msg(LOG_ERR, "fanout: copy %s: %m", src.c_str());
+            res.suspended = stopped;
+            ok = false;
+        }
+        for (size_t i : copying)
+            res.copies[i].method = m;
+        res.bytes = uint64_t(st.st_size) * copying.size();
+    }
+    for (size_t i = 0; i < dests.size(); ++i) {
+        if (out[i] < 0)
+            continue;
+        if (ok && fchmod(out[i], st.st_mode & 07777) != 0)
+            log_msg(LOG_WARNING, "fanout: fchmod %s: %m", (dests[i]->dir() / tmp_name).c_str());
+        if (close(out[i]) != 0 && ok) {
+            log_msg(LOG_ERR, "fanout: write %s: %m", (dests[i]->dir() / tmp_name).c_str());
+            ok = false;
+        }
+    }
+    close(in);
+
+    for (size_t i = 0; ok && i < dests.size(); ++i) {
+        if (int err = dests[i]->commit(to_fd[i], tmp_name, name, &res.copies[i].dst); err != 0) {
+            log_msg(LOG_ERR, "fanout: rename %s -> %s: %s", tmp_name, dests[i]->dir().c_str(), std::strerror(err));
+            ok = false;
+            break;
+        }
+        committed[i] = true;
+    }
+    if (ok) {
+        res.ok = true;
+        return res;
+    }
+    // Всё или ничего: иначе следующий проход доставил бы файл повторно с суффиксом.
+    for (size_t i = 0; i < dests.size(); ++i) {
+        if (committed[i])
+            unlinkat(to_fd[i], res.copies[i].dst.filename().c_str(), 0);
+        else if (staged[i])
+            unlinkat(to_fd[i], tmp_name, 0);
+        if (staged[i])
+            state_copy_end(res.copies[i].journal);
+    }
+    res.copies.clear();
+    res.bytes = 0;
+    return res;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "dest_index.h"
+#include "throttle.h"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+enum class TransferMethod {
+    None,
+    Reflink,
+    CopyFileRange,
+    Sendfile,
+    Splice,
+    ReadWrite,
+    Hardlink, // только fanout=: назначение на той же ФС, что и источник
+};
+
+const char *transfer_method_name(TransferMethod m);
+
+struct TransferResult {
+    TransferMethod method = TransferMethod::None;
+    uint64_t bytes = 0;
+    fs::path dst;
+    bool ok = false;
+    bool suspended = false; // блочное копирование прервано остановкой, продолжится позже
+    int journal = -1; // слот журнала копирований, если источник удаляет вызывающий
+};
+
+// Файлы от chunked_min копируются кусками в threads потоков (copy_file_range
+// или pread/pwrite по смещениям) в заранее выделенный fallocate временный файл.
+// Готовые куски после fdatasync отмечаются в журнале, так что прерванное
+// копирование продолжается, а не начинается заново. direct — O_DIRECT, чтобы
+// многогигабайтный файл не вытеснял из кэша страниц всё остальное.
+struct TransferOptions {
+    uint64_t chunked_min = 256ull << 20; // 0 — всегда одним потоком
+    unsigned threads = 4;
+    bool direct = false;
+    const std::atomic<bool> *stop = nullptr; // проверяется между кусками
+};
+
+// Зовётся при загрузке конфига, пока переносы не идут.
+void transfer_set_options(const TransferOptions &o);
+
+// Межустройственный перенос файла name из каталога from_fd (from_dir — его путь,
+// только для журнала и сообщений): содержимое пишется во временный файл в каталоге
+// назначения, который затем атомарно получает свободное имя через dest.commit();
+// исходник удаляется после этого (unlink_src=false — удаление за вызывающим:
+// он отмечает размещение state_copy_placed(result.journal, result.dst), когда
+// копии можно верить, удаляет источник и закрывает запись state_copy_end).
+// Перебирает FICLONE -> copy_file_range -> sendfile -> splice -> read/write.
+// Остановка посреди блочного копирования: ok=false, suspended=true, tmp остаётся.
+// throttle — лимит байт в секунду; reflink его не расходует.
+TransferResult transfer_file(int from_fd, const char *name, const fs::path &from_dir, DestIndex &dest,
+                             bool unlink_src = true, Throttle *throttle = nullptr);
+
+// Одна доставка fanout_file.
+struct Delivery {
+    TransferMethod method = TransferMethod::None;
+    fs::path dst;
+    int journal = -1;
+};
+
+struct FanoutResult {
+    std::vector<Delivery> copies; // по одной на назначение, в порядке dests
+    uint64_t bytes = 0;           // записано данных; ссылки и reflink не считаются
+    bool ok = false;
+    bool suspended = false;       // прервано остановкой демона
+};
+
+// Доставка файла name из каталога from_fd в каждый из dests (fanout=) без удаления
+// источника. Назначению на той же ФС достаётся жёсткая ссылка, иначе пробуется
+// reflink, а все оставшиеся копии пишутся за один проход чтения источника —
+// параллельно. Каждая доставка атомарно получает свободное имя через свой
+// DestIndex::commit(); записи журнала — как у transfer_file с unlink_src=false.
+// Если не удалась хоть одна доставка, уже сделанные убираются: ok=false, источник
+// и назначения как до вызова. Блочного копирования с продолжением здесь нет.
+FanoutResult fanout_file(int from_fd, const char *name, const fs::path &from_dir, const std::vector<DestIndex *> &dests,
+                         Throttle *throttle = nullptr);
+
+// Временные файлы переноса; сканер не должен их трогать.
+bool is_transfer_temp(const std::string &name);
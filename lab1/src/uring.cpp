@@ -0,0 +1,130 @@
+#include "uring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+static int sys_setup(unsigned entries, io_uring_params *p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+template <class T>
+static T *at(void *base, unsigned off) {
+    return reinterpret_cast<T *>(static_cast<char *>(base) + off);
+}
+
+Uring::~Uring() {
+    close();
+}
+
+void Uring::close() {
+    if (sqes_)
+        munmap(sqes_, sqes_len_);
+    if (cq_ptr_ && cq_ptr_ != sq_ptr_)
+        munmap(cq_ptr_, cq_len_);
+    if (sq_ptr_)
+        munmap(sq_ptr_, sq_len_);
+    if (fd_ >= 0)
+        ::close(fd_);
+    fd_ = -1;
+    sqes_ = nullptr;
+    sq_ptr_ = cq_ptr_ = nullptr;
+    pending_ = 0;
+}
+
+bool Uring::init(unsigned entries) {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    fd_ = sys_setup(entries, &p);
+    if (fd_ < 0)
+        return false;
+    // при любой ошибке ниже кольцо закрывается и ready() == false
+
+    sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        if (cq_len_ > sq_len_)
+            sq_len_ = cq_len_;
+        cq_len_ = sq_len_;
+    }
+
+    sq_ptr_ = mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+        sq_ptr_ = nullptr;
+        close();
+        return false;
+    }
+    if (single) {
+        cq_ptr_ = sq_ptr_;
+    } else {
+        cq_ptr_ = mmap(nullptr, cq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            cq_ptr_ = nullptr;
+            close();
+            return false;
+        }
+    }
+    sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+    void *s = mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (s == MAP_FAILED) {
+        close();
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe *>(s);
+
+    sq_head_  = at<unsigned>(sq_ptr_, p.sq_off.head);
+    sq_tail_  = at<unsigned>(sq_ptr_, p.sq_off.tail);
+    sq_mask_  = at<unsigned>(sq_ptr_, p.sq_off.ring_mask);
+    sq_array_ = at<unsigned>(sq_ptr_, p.sq_off.array);
+    cq_head_  = at<unsigned>(cq_ptr_, p.cq_off.head);
+    cq_tail_  = at<unsigned>(cq_ptr_, p.cq_off.tail);
+    cq_mask_  = at<unsigned>(cq_ptr_, p.cq_off.ring_mask);
+    cqes_     = at<io_uring_cqe>(cq_ptr_, p.cq_off.cqes);
+    sq_entries_ = p.sq_entries;
+    return true;
+}
+
+io_uring_sqe *Uring::get_sqe() {
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    unsigned tail = *sq_tail_ + pending_;
+    if (tail - head >= sq_entries_)
+        return nullptr;
+    unsigned idx = tail & *sq_mask_;
+    io_uring_sqe *sqe = &sqes_[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+    ++pending_;
+    return sqe;
+}
+
+int Uring::submit_and_wait(unsigned wait_nr) {
+    unsigned n = pending_;
+    __atomic_store_n(sq_tail_, *sq_tail_ + n, __ATOMIC_RELEASE);
+    pending_ = 0;
+    for (;;) {
+        int rc = sys_enter(fd_, n, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+        if (rc >= 0 || errno != EINTR)
+            return rc;
+        // досылаем то, что ядро ещё не забрало из очереди, и продолжаем ждать
+        n = *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    }
+}
+
+io_uring_cqe *Uring::peek_cqe() {
+    unsigned head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+        return nullptr;
+    return &cqes_[head & *cq_mask_];
+}
+
+void Uring::cqe_seen() {
+    __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// Минимальная обёртка над io_uring на голых системных вызовах (без liburing).
+// Один экземпляр на поток: кольца не синхронизируются.
+class Uring {
+public:
+    Uring() = default;
+    ~Uring();
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    bool init(unsigned entries);
+    void close();
+    bool ready() const { return fd_ >= 0; }
+    unsigned capacity() const { return sq_entries_; }
+
+    // nullptr, если очередь отправки заполнена.
+    io_uring_sqe *get_sqe();
+    // Отправляет подготовленные sqe и ждёт не менее wait_nr завершений.
+    int submit_and_wait(unsigned wait_nr);
+    // Следующее завершение или nullptr; после обработки — cqe_seen().
+    io_uring_cqe *peek_cqe();
+    void cqe_seen();
+
+private:
+    int fd_ = -1;
+    unsigned sq_entries_ = 0;
+    unsigned pending_ = 0;
+
+    void *sq_ptr_ = nullptr;
+    void *cq_ptr_ = nullptr;
+    size_t sq_len_ = 0;
+    size_t cq_len_ = 0;
+    io_uring_sqe *sqes_ = nullptr;
+    size_t sqes_len_ = 0;
+
+    unsigned *sq_head_ = nullptr;
+    unsigned *sq_tail_ = nullptr;
+    unsigned *sq_mask_ = nullptr;
+    unsigned *sq_array_ = nullptr;
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned *cq_mask_ = nullptr;
+    io_uring_cqe *cqes_ = nullptr;
+};
@@ -8,23 +8,14 @@ std::string to_lower(std::string s) {
     return s;
 }
 
-std::string ext_lower_of(const fs::path &p) {
-    auto e = p.extension().string();
-    if (!e.empty() && e.front() == '.')
-        e.erase(0, 1);
-    return to_lower(e);
-}
-
-fs::path unique_dest_path(fs::path dest_dir, fs::path base_name) {
-    fs::path candidate = dest_dir / base_name;
-    if (!fs::exists(candidate))
-        return candidate;
-    auto stem = base_name.stem().string();
-    auto ext  = base_name.extension().string();
-    for (int i = 1; i < 10000; ++i) {
-        fs::path cand = dest_dir / fs::path(stem + "(" + std::to_string(i) + ")" + ext);
-        if (!fs::exists(cand))
-            return cand;
-    }
-    return candidate;
+bool ext_of(const char *name, size_t len, const char *&ext, size_t &ext_len) {
+    size_t dot = len;
+    while (dot > 0 && name[dot - 1] != '.')
+        --dot;
+    // нет точки или она ведущая (".bashrc") — расширения нет
+    if (dot <= 1)
+        return false;
+    ext = name + dot;
+    ext_len = len - dot;
+    return true;
 }
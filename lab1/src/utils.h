@@ -6,5 +6,5 @@
 namespace fs = std::filesystem;
 
 std::string to_lower(std::string s);
-std::string ext_lower_of(const fs::path &p);
-fs::path unique_dest_path(fs::path dest_dir, fs::path base_name);
\ No newline at end of file
+// Расширение имени без точки как указатель внутрь name, без выделения памяти.
+bool ext_of(const char *name, size_t len, const char *&ext, size_t &ext_len);
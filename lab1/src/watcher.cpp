@@ -0,0 +1,100 @@
+#include "watcher.h"
+#include "log.h"
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cerrno>
+
+static constexpr uint32_t kWatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR | IN_DELETE_SELF | IN_MOVE_SELF;
+
+Watcher::~Watcher() {
+    close();
+}
+
+bool Watcher::open() {
+    if (fd_ >= 0)
+        return true;
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ < 0) {
+        log_msg(LOG_ERR, "inotify_init1: %m");
+        return false;
+    }
+    return true;
+}
+
+void Watcher::adopt(int fd) {
+    close();
+    fd_ = fd;
+}
+
+void Watcher::close() {
+    if (fd_ >= 0)
+        ::close(fd_);
+    fd_ = -1;
+    wd_source_.clear();
+    removed_.clear();
+}
+
+void Watcher::rebuild(const std::vector<SourceGroup>& sources) {
+    if (fd_ < 0)
+        return;
+    // Каталог, который остаётся под наблюдением, получает от inotify_add_watch тот же
+    // wd — снимаются только лишние. Их IN_IGNORED ожидаем и не считаем пропажей каталога.
+    std::unordered_map<int, size_t> fresh;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        int wd = inotify_add_watch(fd_, sources[i].from.c_str(), kWatchMask);
+        if (wd < 0) {
+            log_msg(LOG_WARNING, "inotify_add_watch %s: %m", sources[i].from.c_str());
+            continue;
+        }
+        fresh[wd] = i;
+    }
+    for (const auto& [wd, _] : wd_source_)
+        if (!fresh.count(wd) && inotify_rm_watch(fd_, wd) == 0)
+            removed_.insert(wd);
+    wd_source_.swap(fresh);
+}
+
+bool Watcher::drain(std::vector<WatchEvent>& out) {
+    alignas(struct inotify_event) char buf[64 * 1024];
+    bool complete = true;
+    for (;;) {
+        ssize_t n = read(fd_, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                log_msg(LOG_ERR, "inotify read: %m");
+            break;
+        }
+        if (n == 0)
+            break;
+
+        for (char* p = buf; p < buf + n; ) {
+            auto* ev = reinterpret_cast<struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                complete = false;
+                continue;
+            }
+            if ((ev->mask & IN_IGNORED) && removed_.erase(ev->wd))
+                continue; // снят нами в rebuild()
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                // каталог пропал или переехал — пусть разбирается плановый проход
+                complete = false;
+                continue;
+            }
+            if ((ev->mask & IN_ISDIR) || ev->len == 0)
+                continue;
+
+            auto it = wd_source_.find(ev->wd);
+            if (it == wd_source_.end())
+                continue;
+            out.push_back(WatchEvent{it->second, std::string(ev->name)});
+        }
+    }
+    return complete;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "config.h"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct WatchEvent {
+    size_t source;    // индекс группы в таблице источников
+    std::string name; // имя файла внутри from
+};
+
+class Watcher {
+public:
+    Watcher() = default;
+    ~Watcher();
+    Watcher(const Watcher&) = delete;
+    Watcher& operator=(const Watcher&) = delete;
+
+    bool open();
+    // Готовый дескриптор inotify прежнего экземпляра: накопленные в нём события
+    // не теряются, а rebuild() получит для тех же каталогов те же wd.
+    void adopt(int fd);
+    void close();
+    void rebuild(const std::vector<SourceGroup>& sources);
+
+    int fd() const { return fd_; }
+    bool active() const { return fd_ >= 0; }
+
+    // Вычитывает все накопившиеся события; false — очередь ядра переполнилась
+    // и нужен полный проход по каталогам.
+    bool drain(std::vector<WatchEvent>& out);
+
+private:
+    int fd_ = -1;
+    std::unordered_map<int, size_t> wd_source_;
+    std::unordered_set<int> removed_; // сняты rebuild(), ждут своего IN_IGNORED
+};
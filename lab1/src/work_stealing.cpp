@@ -0,0 +1,83 @@
+#include "work_stealing.h"
+
+#include <thread>
+
+WorkStealingPool::WorkStealingPool(size_t threads) {
+    if (threads == 0)
+        threads = 1;
+    for (size_t i = 0; i < threads; ++i)
+        queues_.push_back(std::make_unique<Queue>());
+}
+
+// Счётчики меняются до захвата idle_mu_, а ждущий проверяет их под ним же,
+// так что пробуждение не теряется и ждать можно без таймаута.
+void WorkStealingPool::wake(bool all) {
+    { std::lock_guard<std::mutex> lk(idle_mu_); }
+    if (all)
+        idle_cv_.notify_all();
+    else
+        idle_cv_.notify_one();
+}
+
+void WorkStealingPool::push(size_t worker, Task t) {
+    pending_.fetch_add(1, std::memory_order_acq_rel);
+    {
+        std::lock_guard<std::mutex> lk(queues_[worker]->mu);
+        queues_[worker]->q.push_back(std::move(t));
+    }
+    queued_.fetch_add(1, std::memory_order_acq_rel);
+    wake(false);
+}
+
+bool WorkStealingPool::take(size_t self, Task &out) {
+    {
+        Queue &own = *queues_[self];
+        std::lock_guard<std::mutex> lk(own.mu);
+        if (!own.q.empty()) {
+            out = std::move(own.q.back());
+            own.q.pop_back();
+            queued_.fetch_sub(1, std::memory_order_acq_rel);
+            return true;
+        }
+    }
+    for (size_t k = 1; k < queues_.size(); ++k) {
+        Queue &victim = *queues_[(self + k) % queues_.size()];
+        std::lock_guard<std::mutex> lk(victim.mu);
+        if (!victim.q.empty()) {
+            out = std::move(victim.q.front());
+            victim.q.pop_front();
+            queued_.fetch_sub(1, std::memory_order_acq_rel);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::loop(size_t self) {
+    for (;;) {
+        Task t;
+        if (take(self, t)) {
+            t(self);
+            if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                wake(true);
+            continue;
+        }
+        // Работа есть, но вся выполняется: ждём новых задач или конца.
+        std::unique_lock<std::mutex> lk(idle_mu_);
+        idle_cv_.wait(lk, [this] {
+            return pending_.load(std::memory_order_acquire) == 0 || queued_.load(std::memory_order_acquire) > 0;
+        });
+        if (pending_.load(std::memory_order_acquire) == 0)
+            return;
+    }
+}
+
+void WorkStealingPool::run(Task root) {
+    push(0, std::move(root));
+    std::vector<std::thread> helpers;
+    for (size_t i = 1; i < queues_.size(); ++i)
+        helpers.emplace_back(&WorkStealingPool::loop, this, i);
+    loop(0);
+    for (auto &t : helpers)
+        t.join();
+}
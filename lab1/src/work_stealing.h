@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Пул с перехватом задач: у каждого потока своя дека, свои задачи берутся
+// с конца (LIFO — обход в глубину, тёплый кэш), чужие — с начала (FIFO —
+// крадутся крупные поддеревья). Задачи могут порождать новые через push().
+class WorkStealingPool {
+public:
+    using Task = std::function<void(size_t worker)>;
+
+    explicit WorkStealingPool(size_t threads);
+
+    size_t threads() const { return queues_.size(); }
+    // Из задачи — в деку текущего потока worker.
+    void push(size_t worker, Task t);
+    // Выполняет root и всё, что из него выросло; блокируется до конца.
+    void run(Task root);
+
+private:
+    struct Queue {
+        std::mutex mu;
+        std::deque<Task> q;
+    };
+
+    bool take(size_t self, Task &out);
+    void loop(size_t self);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    void wake(bool all);
+
+    std::atomic<size_t> pending_{0}; // поставлены и ещё не завершены
+    std::atomic<size_t> queued_{0};  // лежат в деках
+    std::mutex idle_mu_;
+    std::condition_variable idle_cv_;
+};
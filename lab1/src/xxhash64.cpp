@@ -0,0 +1,121 @@
+#include "xxhash64.h"
+
+#include <cstring>
+
+static constexpr uint64_t P1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t P3 = 0x165667B19E3779F9ULL;
+static constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian чтение без требований к выравниванию.
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t round(uint64_t acc, uint64_t input) {
+    acc += input * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+}
+
+static inline uint64_t merge(uint64_t acc, uint64_t v) {
+    acc ^= round(0, v);
+    return acc * P1 + P4;
+}
+
+void Xxh64::reset(uint64_t seed) {
+    seed_ = seed;
+    v_[0] = seed + P1 + P2;
+    v_[1] = seed + P2;
+    v_[2] = seed;
+    v_[3] = seed - P1;
+    total_ = 0;
+    buf_len_ = 0;
+}
+
+void Xxh64::update(const void *data, size_t len) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    const unsigned char *end = p + len;
+    total_ += len;
+
+    if (buf_len_ + len < 32) {
+        std::memcpy(buf_ + buf_len_, p, len);
+        buf_len_ += len;
+        return;
+    }
+    if (buf_len_) {
+        size_t fill = 32 - buf_len_;
+        std::memcpy(buf_ + buf_len_, p, fill);
+        p += fill;
+        for (int i = 0; i < 4; ++i)
+            v_[i] = round(v_[i], read64(buf_ + 8 * i));
+        buf_len_ = 0;
+    }
+    // Четыре независимые полосы — компилятор раскладывает их по конвейеру/векторам.
+    uint64_t a = v_[0], b = v_[1], c = v_[2], d = v_[3];
+    for (; p + 32 <= end; p += 32) {
+        a = round(a, read64(p));
+        b = round(b, read64(p + 8));
+        c = round(c, read64(p + 16));
+        d = round(d, read64(p + 24));
+    }
+    v_[0] = a, v_[1] = b, v_[2] = c, v_[3] = d;
+    if (p < end) {
+        buf_len_ = static_cast<size_t>(end - p);
+        std::memcpy(buf_, p, buf_len_);
+    }
+}
+
+uint64_t Xxh64::digest() const {
+    uint64_t h;
+    if (total_ >= 32) {
+        h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+        for (int i = 0; i < 4; ++i)
+            h = merge(h, v_[i]);
+    } else {
+        h = seed_ + P5;
+    }
+    h += total_;
+
+    const unsigned char *p = buf_;
+    const unsigned char *end = buf_ + buf_len_;
+    for (; p + 8 <= end; p += 8) {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * P1 + P4;
+    }
+    if (p + 4 <= end) {
+        h ^= uint64_t(read32(p)) * P1;
+        h = rotl(h, 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= (*p) * P5;
+        h = rotl(h, 11) * P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed) {
+    Xxh64 s(seed);
+    s.update(data, len);
+    return s.digest();
+}
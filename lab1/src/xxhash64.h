@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH64 (совместим с эталонной реализацией xxHash). Потоковый вариант:
+// update() можно звать кусками любого размера, digest() не портит состояние.
+class Xxh64 {
+public:
+    explicit Xxh64(uint64_t seed = 0) { reset(seed); }
+
+    void reset(uint64_t seed = 0);
+    void update(const void *data, size_t len);
+    uint64_t digest() const;
+
+private:
+    uint64_t v_[4];
+    uint64_t total_ = 0;
+    unsigned char buf_[32];
+    size_t buf_len_ = 0;
+    uint64_t seed_ = 0;
+};
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed = 0);
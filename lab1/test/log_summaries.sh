@@ -0,0 +1,46 @@
+#!/usr/bin/env bash
+# Итог прохода печатается для каждого правила, даже когда их больше, чем
+# пропускает ограничитель похожих сообщений журнала (kLogBurst в секунду):
+# bash test/log_summaries.sh [число правил, по умолчанию 12]
+set -euo pipefail
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+RULES="${1:-12}"
+
+bash "$ROOT/build.sh" >/dev/null
+
+DIR="$(mktemp -d)"
+PID="$DIR/lab1d.pid"
+cleanup() {
+  [ -f "$PID" ] && kill "$(cat "$PID")" 2>/dev/null || true
+  rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+{
+  echo "interval 60"
+  echo "log $DIR/lab1d.log"
+  echo "metrics off"
+  for i in $(seq "$RULES"); do
+    mkdir -p "$DIR/from$i" "$DIR/to$i"
+    echo x > "$DIR/from$i/f.txt"
+    echo "$DIR/from$i $DIR/to$i +*"
+  done
+} > "$DIR/lab1d.conf"
+
+"$ROOT/bin/lab1d" --config "$DIR/lab1d.conf" --pid "$PID"
+
+# первый проход идёт сразу после старта
+count=0
+for _ in $(seq 50); do
+  count="$(grep -c ' rule: from=' "$DIR/lab1d.log" 2>/dev/null || true)"
+  [ "${count:-0}" -ge "$RULES" ] && break
+  sleep 0.1
+done
+
+if [ "${count:-0}" -ne "$RULES" ] || grep -q 'similar messages suppressed' "$DIR/lab1d.log"; then
+  echo "FAIL: $count of $RULES rule summaries" >&2
+  cat "$DIR/lab1d.log" >&2
+  exit 1
+fi
+echo "ok: $RULES rule summaries"